@@ -0,0 +1,73 @@
+#include "engine_model.h"
+
+#include <ATen/Parallel.h>
+
+namespace {
+
+    EngineConv make_conv(torch::nn::Conv2d &conv, torch::nn::BatchNorm2d &batch_norm) {
+        torch::Tensor weight, bias;
+        std::tie(weight, bias) = fold_batch_norm(conv, batch_norm);
+        weight = weight.to(torch::kCPU, torch::kFloat).contiguous();
+        bias = bias.to(torch::kCPU, torch::kFloat).contiguous();
+        return EngineConv(weight.data_ptr<float>(), bias.data_ptr<float>(), (int) weight.size(1),
+                          (int) weight.size(0), (int) weight.size(2));
+    }
+
+    EngineLinear make_linear(torch::nn::Linear &linear) {
+        auto weight = linear->weight.detach().to(torch::kCPU, torch::kFloat).contiguous();
+        auto bias = linear->bias.detach().to(torch::kCPU, torch::kFloat).contiguous();
+        return EngineLinear(weight.data_ptr<float>(), bias.data_ptr<float>(), (int) weight.size(1),
+                            (int) weight.size(0));
+    }
+}
+
+EngineJackalModel::EngineJackalModel(JackalModel &model) :
+        engine((int) model->input_shape[2], (int) model->input_shape[3], (int) model->input_shape[1],
+               model->players, model->action_value) {
+    torch::NoGradGuard no_grad;
+    model->eval();
+    engine.conv = make_conv(model->conv->conv2d, model->conv->batch_norm);
+    for (auto &res_model : model->res_models) {
+        engine.blocks.emplace_back(make_conv(res_model->conv->conv2d, res_model->conv->batch_norm),
+                                   make_conv(res_model->conv2d, res_model->batch_norm));
+    }
+    engine.value_conv = make_conv(model->value_head->conv2d, model->value_head->batch_norm);
+    engine.value_linear = make_linear(model->value_head->linear1);
+    engine.value_output = make_linear(model->value_head->latent_state);
+    if (model->action_value && model->policy_head_type == POLICY_HEAD_FACTORIZED) {
+        auto &head = model->factorized_policy_head;
+        engine.policy_conv = make_conv(head->conv2d, head->batch_norm);
+        auto weight = head->output->weight.detach().to(torch::kCPU, torch::kFloat).contiguous();
+        auto bias = head->output->bias.detach().to(torch::kCPU, torch::kFloat).contiguous();
+        engine.policy_output = EngineConv(weight.data_ptr<float>(), bias.data_ptr<float>(), (int) weight.size(1),
+                                          (int) weight.size(0), 1);
+    } else if (model->action_value) {
+        engine.policy_conv = make_conv(model->policy_head->conv2d, model->policy_head->batch_norm);
+        engine.policy_linear = make_linear(model->policy_head->linear);
+    }
+}
+
+void EngineJackalModel::to(torch::Device device) {
+    if (!device.is_cpu()) {
+        throw std::runtime_error("the ResNetEngine model runs on CPU only");
+    }
+}
+
+GameModelOutput EngineJackalModel::forward(const torch::Tensor &batch) {
+    auto input = batch.to(torch::kCPU, torch::kFloat).contiguous();
+    int size = (int) input.size(0);
+    int sample_size = (int) (input.numel() / std::max(size, 1));
+    auto value = torch::empty({size, engine.players});
+    torch::Tensor policy;
+    if (engine.action_value) {
+        policy = torch::empty({size, engine.policy_size()});
+    }
+    const float *in = input.data_ptr<float>();
+    float *v = value.data_ptr<float>();
+    float *p = engine.action_value ? policy.data_ptr<float>() : nullptr;
+    at::parallel_for(0, size, 1, [&](int64_t begin, int64_t end) {
+        engine.forward(in + begin * sample_size, int(end - begin), v + begin * engine.players,
+                       p ? p + begin * engine.policy_size() : nullptr, !raw_policy);
+    });
+    return GameModelOutput{policy, value};
+}
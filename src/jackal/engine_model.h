@@ -0,0 +1,19 @@
+#pragma once
+
+#include <torch/torch.h>
+#include "game_model.h"
+#include "resnet_engine.h"
+
+
+// JackalModel evaluated by the hand-written ResNetEngine kernels, CPU only. Samples of a batch are spread over the
+// libtorch intra-op thread pool.
+class EngineJackalModel : public InferenceModel {
+    ResNetEngine engine;
+
+public:
+    explicit EngineJackalModel(JackalModel &model);
+
+    void to(torch::Device device) override;
+
+    GameModelOutput forward(const torch::Tensor &batch) override;
+};
@@ -0,0 +1,156 @@
+#include "frozen_model.h"
+
+FrozenJackalModel::FrozenJackalModel(JackalModel &model) :
+        action_value(model->action_value), policy_head_type(model->policy_head_type) {
+    torch::NoGradGuard no_grad;
+    model->eval();
+    auto make_conv = [](torch::nn::Conv2d &conv, torch::nn::BatchNorm2d &batch_norm) {
+        Conv result;
+        std::tie(result.weight, result.bias) = fold_batch_norm(conv, batch_norm);
+        result.padding = result.weight.size(2) / 2;
+        return result;
+    };
+    auto make_linear = [](torch::nn::Linear &linear) {
+        return Linear{linear->weight.detach().clone(), linear->bias.detach().clone()};
+    };
+    conv = make_conv(model->conv->conv2d, model->conv->batch_norm);
+    for (auto &res_model : model->res_models) {
+        blocks.emplace_back(make_conv(res_model->conv->conv2d, res_model->conv->batch_norm),
+                            make_conv(res_model->conv2d, res_model->batch_norm));
+    }
+    value_conv = make_conv(model->value_head->conv2d, model->value_head->batch_norm);
+    value_linear = make_linear(model->value_head->linear1);
+    value_output = make_linear(model->value_head->latent_state);
+    if (action_value && policy_head_type == POLICY_HEAD_FACTORIZED) {
+        auto &head = model->factorized_policy_head;
+        policy_conv = make_conv(head->conv2d, head->batch_norm);
+        policy_output = Conv{head->output->weight.detach().clone(), head->output->bias.detach().clone(), 0};
+    } else if (action_value) {
+        policy_conv = make_conv(model->policy_head->conv2d, model->policy_head->batch_norm);
+        policy_linear = make_linear(model->policy_head->linear);
+    }
+}
+
+FrozenJackalModel::FrozenJackalModel(const std::string &fname) {
+    std::vector<torch::Tensor> t;
+    torch::load(t, fname);
+    // header: number of residual blocks, action value flag, policy head type (absent in older files)
+    int num_blocks = t[0][0].item<int>();
+    action_value = t[0][1].item<int>() > 0;
+    policy_head_type = t[0].numel() > 2 ? t[0][2].item<int>() : POLICY_HEAD_DENSE;
+    int i = 1;
+    auto next_conv = [&t, &i]() {
+        Conv result{t[i], t[i + 1], t[i].size(2) / 2};
+        i += 2;
+        return result;
+    };
+    auto next_linear = [&t, &i]() {
+        Linear result{t[i], t[i + 1]};
+        i += 2;
+        return result;
+    };
+    conv = next_conv();
+    for (int b = 0; b < num_blocks; ++b) {
+        auto conv1 = next_conv();
+        auto conv2 = next_conv();
+        blocks.emplace_back(conv1, conv2);
+    }
+    value_conv = next_conv();
+    value_linear = next_linear();
+    value_output = next_linear();
+    if (action_value && policy_head_type == POLICY_HEAD_FACTORIZED) {
+        policy_conv = next_conv();
+        policy_output = next_conv();
+    } else if (action_value) {
+        policy_conv = next_conv();
+        policy_linear = next_linear();
+    }
+}
+
+std::vector<torch::Tensor> FrozenJackalModel::tensors() const {
+    std::vector<torch::Tensor> t{torch::tensor({(int) blocks.size(), (int) action_value, policy_head_type})};
+    auto add_conv = [&t](const Conv &c) {
+        t.push_back(c.weight);
+        t.push_back(c.bias);
+    };
+    auto add_linear = [&t](const Linear &l) {
+        t.push_back(l.weight);
+        t.push_back(l.bias);
+    };
+    add_conv(conv);
+    for (auto &block : blocks) {
+        add_conv(block.first);
+        add_conv(block.second);
+    }
+    add_conv(value_conv);
+    add_linear(value_linear);
+    add_linear(value_output);
+    if (action_value && policy_head_type == POLICY_HEAD_FACTORIZED) {
+        add_conv(policy_conv);
+        add_conv(policy_output);
+    } else if (action_value) {
+        add_conv(policy_conv);
+        add_linear(policy_linear);
+    }
+    return t;
+}
+
+void FrozenJackalModel::save(const std::string &fname) const {
+    auto t = tensors();
+    for (auto &tensor : t) {
+        tensor = tensor.to(torch::kCPU);
+    }
+    torch::save(t, fname);
+}
+
+void FrozenJackalModel::to(torch::Device device) {
+    auto move_conv = [device](Conv &c) {
+        c.weight = c.weight.to(device);
+        c.bias = c.bias.to(device);
+    };
+    auto move_linear = [device](Linear &l) {
+        l.weight = l.weight.to(device);
+        l.bias = l.bias.to(device);
+    };
+    move_conv(conv);
+    for (auto &block : blocks) {
+        move_conv(block.first);
+        move_conv(block.second);
+    }
+    move_conv(value_conv);
+    move_linear(value_linear);
+    move_linear(value_output);
+    if (action_value && policy_head_type == POLICY_HEAD_FACTORIZED) {
+        move_conv(policy_conv);
+        move_conv(policy_output);
+    } else if (action_value) {
+        move_conv(policy_conv);
+        move_linear(policy_linear);
+    }
+}
+
+GameModelOutput FrozenJackalModel::forward(const torch::Tensor &batch) {
+    torch::NoGradGuard no_grad;
+    auto apply = [](const Conv &c, const torch::Tensor &x) {
+        return torch::conv2d(x, c.weight, c.bias, 1, c.padding);
+    };
+    auto x = apply(conv, batch.to(conv.weight.scalar_type())).relu_();
+    for (auto &block : blocks) {
+        auto y = apply(block.first, x).relu_();
+        x = apply(block.second, y).add_(x).relu_();
+    }
+    auto v = apply(value_conv, x).relu_();
+    v = torch::linear(v.reshape({v.size(0), -1}), value_linear.weight, value_linear.bias).relu_();
+    v = torch::linear(v, value_output.weight, value_output.bias).tanh_();
+    torch::Tensor policy;
+    if (action_value && policy_head_type == POLICY_HEAD_FACTORIZED) {
+        auto p = apply(policy_output, apply(policy_conv, x).relu_());
+        policy = p.permute({0, 2, 3, 1}).reshape({p.size(0), -1});
+        policy = raw_policy ? policy.contiguous() : torch::log_softmax(policy, 1);
+    } else if (action_value) {
+        auto p = apply(policy_conv, x).relu_();
+        p = torch::linear(p.reshape({p.size(0), -1}), policy_linear.weight, policy_linear.bias);
+        policy = raw_policy ? p : torch::log_softmax(p, 1);
+    }
+    return GameModelOutput{policy, v};
+}
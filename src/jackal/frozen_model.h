@@ -0,0 +1,45 @@
+#pragma once
+
+#include <torch/torch.h>
+#include "game_model.h"
+
+
+// Inference-only JackalModel: every BatchNorm is folded into the preceding convolution, the residual blocks are
+// flattened into a plain list of weights, and no autograd or module lookups happen on forward.
+class FrozenJackalModel : public InferenceModel {
+    struct Conv {
+        torch::Tensor weight;
+        torch::Tensor bias;
+        int64_t padding;
+    };
+
+    struct Linear {
+        torch::Tensor weight;
+        torch::Tensor bias;
+    };
+
+    Conv conv;
+    std::vector<std::pair<Conv, Conv>> blocks;
+    Conv value_conv;
+    Linear value_linear;
+    Linear value_output;
+    Conv policy_conv;
+    Linear policy_linear;
+    Conv policy_output;
+    bool action_value;
+    int policy_head_type;
+
+    std::vector<torch::Tensor> tensors() const;
+
+public:
+    explicit FrozenJackalModel(JackalModel &model);
+
+    // loads a module written by save()
+    explicit FrozenJackalModel(const std::string &fname);
+
+    void save(const std::string &fname) const;
+
+    void to(torch::Device device) override;
+
+    GameModelOutput forward(const torch::Tensor &batch) override;
+};
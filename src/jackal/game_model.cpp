@@ -81,17 +81,46 @@ torch::Tensor PolicyHeadImpl::forward(torch::Tensor x) {
     return torch::log_softmax(x, 1);
 }
 
+FactorizedPolicyHeadImpl::FactorizedPolicyHeadImpl(c10::IntArrayRef input_shape, int head_channels) :
+        head_channels(head_channels) {
+    int input_channels = (int) input_shape[0];
+    int height = (int) input_shape[1];
+    int width = (int) input_shape[2];
+    conv2d = register_module("conv2d", torch::nn::Conv2d(input_channels, head_channels, 1));
+    batch_norm = register_module("batch_norm", torch::nn::BatchNorm2d(head_channels));
+    output = register_module("output", torch::nn::Conv2d(head_channels, (width * height) * 2, 1));
+}
+
+torch::Tensor FactorizedPolicyHeadImpl::forward(torch::Tensor x) {
+    x = conv2d(x);
+    x = batch_norm(x);
+    x = torch::relu(x);
+    x = output(x);
+    // [batch, offset * 2 + with_items, from_y, from_x] -> [batch, (from_y, from_x, offset, with_items)]
+    x = x.permute({0, 2, 3, 1}).reshape({x.size(0), -1});
+    return torch::log_softmax(x, 1);
+}
+
 JackalModelImpl::JackalModelImpl(c10::IntArrayRef input_shape, int res_channels, int blocks, int players,
-                                 bool action_value) : blocks(blocks) {
+                                 bool action_value, int policy_head_type) :
+        input_shape(input_shape.vec()),
+        res_channels(res_channels),
+        blocks(blocks),
+        players(players),
+        action_value(action_value),
+        policy_head_type(policy_head_type) {
     assert(input_shape.size() == 4);
     int input_channels = (int) input_shape[1];
     int height = (int) input_shape[2];
     int width = (int) input_shape[3];
     conv = register_module("conv", ConvModel(input_channels, res_channels));
     for (int i = 0; i < blocks; ++i) {
-        register_module("res" + std::to_string(i), ResModel(res_channels));
+        res_models.push_back(register_module("res" + std::to_string(i), ResModel(res_channels)));
     }
-    if (action_value) {
+    if (action_value && policy_head_type == POLICY_HEAD_FACTORIZED) {
+        factorized_policy_head = register_module(
+                "factorized_policy_head", FactorizedPolicyHead(c10::IntArrayRef({res_channels, height, width}), 32));
+    } else if (action_value) {
         policy_head = register_module("policy_head", PolicyHead(c10::IntArrayRef({res_channels, height, width}), 4));
     }
     int head_channels = 2;
@@ -101,16 +130,32 @@ JackalModelImpl::JackalModelImpl(c10::IntArrayRef input_shape, int res_channels,
 
 GameModelOutput JackalModelImpl::forward(torch::Tensor x) {
     x = conv(x);
-    for (int i = 0; i < blocks; ++i) {
-        auto res_model = named_children()["res" + std::to_string(i)]->as<ResModel>();
+    for (auto &res_model : res_models) {
         x = res_model->forward(x);
     }
     torch::Tensor policy;
     if (policy_head) {
         policy = policy_head(x);
+    } else if (factorized_policy_head) {
+        policy = factorized_policy_head(x);
     }
     auto value = value_head(x);
     return GameModelOutput{policy, value};
 }
 
+JackalModel clone_model(JackalModel &model) {
+    JackalModel replica(model->input_shape, model->res_channels, model->blocks, model->players, model->action_value,
+                        model->policy_head_type);
+    copy_weights(model, replica);
+    return replica;
+}
 
+std::pair<torch::Tensor, torch::Tensor> fold_batch_norm(torch::nn::Conv2d &conv, torch::nn::BatchNorm2d &batch_norm) {
+    torch::NoGradGuard no_grad;
+    auto inv_std = torch::rsqrt(batch_norm->running_var + batch_norm->options.eps());
+    auto gamma = batch_norm->weight * inv_std;
+    auto weight = conv->weight * gamma.reshape({-1, 1, 1, 1});
+    auto conv_bias = conv->bias.defined() ? conv->bias : torch::zeros_like(batch_norm->running_mean);
+    auto bias = (conv_bias - batch_norm->running_mean) * gamma + batch_norm->bias;
+    return {weight.detach().contiguous(), bias.detach().contiguous()};
+}
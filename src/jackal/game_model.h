@@ -64,21 +64,55 @@ struct PolicyHeadImpl : torch::nn::Module {
 TORCH_MODULE(PolicyHead);
 
 
+// Policy head without the dense (W*H)^2*2 layer: a 1x1 convolution scores every move at its from-square, with one
+// output channel per (target offset, with_items) pair. Offsets wrap around the board, so the output planes line up
+// with the action codes of Jackal::encode_action.
+struct FactorizedPolicyHeadImpl : torch::nn::Module {
+    int head_channels;
+    torch::nn::Conv2d conv2d{nullptr};
+    torch::nn::BatchNorm2d batch_norm{nullptr};
+    torch::nn::Conv2d output{nullptr};
+
+    FactorizedPolicyHeadImpl(c10::IntArrayRef input_shape, int head_channels);
+
+    torch::Tensor forward(torch::Tensor x);
+};
+
+TORCH_MODULE(FactorizedPolicyHead);
+
+const int POLICY_HEAD_DENSE = 0;
+const int POLICY_HEAD_FACTORIZED = 1;
+
+
 struct JackalModelImpl : torch::nn::Module {
     ConvModel conv{nullptr};
     ValueHead value_head{nullptr};
     PolicyHead policy_head{nullptr};
+    FactorizedPolicyHead factorized_policy_head{nullptr};
+    std::vector<ResModel> res_models;
+    std::vector<int64_t> input_shape;
+    int res_channels;
     int blocks;
+    int players;
+    bool action_value;
+    int policy_head_type;
 
     explicit JackalModelImpl(c10::IntArrayRef input_shape = {1, 19, 12, 12},
                     int res_channels = 128,
                     int blocks = 10,
                     int players = 2,
-                    bool action_value=true);
+                    bool action_value=true,
+                    int policy_head_type = POLICY_HEAD_DENSE);
 
     GameModelOutput forward(torch::Tensor x);
 };
 
 TORCH_MODULE(JackalModel);
 
+// Conv2d weight and bias with the eval-mode BatchNorm2d that follows it folded in
+std::pair<torch::Tensor, torch::Tensor> fold_batch_norm(torch::nn::Conv2d &conv, torch::nn::BatchNorm2d &batch_norm);
+
+// Builds a model with the same architecture and a copy of the weights, e.g. a replica for another inference worker.
+JackalModel clone_model(JackalModel &model);
+
 
@@ -129,7 +129,10 @@ void Jackal::load(torch::Tensor &state) {
     int player_idx = 0;
     turn = 0;
     while (plane < state.size(0)) {
-        Player p(player_idx);
+        if (player_idx >= players.size()) {
+            players.emplace_back(Player(player_idx));
+        }
+        auto &p = players[player_idx];
         p.load(state.index({Slice(plane, plane + PLAYER_PLANES_NUMBER), "..."}));
         plane += PLAYER_PLANES_NUMBER;
         if (p.is_current_player()) {
@@ -182,12 +185,17 @@ Jackal Jackal::take_action(const torch::Tensor &taction, float temperature) {
     return take_action(get_possible_actions()[action_idx]);
 }
 
+// The target is stored as an offset from the source square that wraps around the board. Every target still gets a
+// unique code, and a move in a given direction keeps the same offset code wherever it starts, which is the layout
+// of the FactorizedPolicyHead output planes.
 int Jackal::encode_action(const Action &action) const {
+    int offset_y = (action.coordinates_to.y - action.coordinates_from.y + height()) % height();
+    int offset_x = (action.coordinates_to.x - action.coordinates_from.x + width()) % width();
     std::vector<std::pair<int, int>> elements{
             {action.coordinates_from.y, height()},
             {action.coordinates_from.x, width()},
-            {action.coordinates_to.y,   height()},
-            {action.coordinates_to.x,   width()},
+            {offset_y,                  height()},
+            {offset_x,                  width()},
             {action.with_items,         2},
     };
     int code = 0;
@@ -200,10 +208,11 @@ int Jackal::encode_action(const Action &action) const {
 
 Action Jackal::decode_action(int code) const {
     Action action;
+    int offset_y, offset_x;
     std::vector<std::pair<int *, int>> fields{
             {&action.with_items,         2},
-            {&action.coordinates_to.x,   width()},
-            {&action.coordinates_to.y,   height()},
+            {&offset_x,                  width()},
+            {&offset_y,                  height()},
             {&action.coordinates_from.x, width()},
             {&action.coordinates_from.y, height()},
     };
@@ -211,6 +220,8 @@ Action Jackal::decode_action(int code) const {
         *field.first = code % field.second;
         code /= field.second;
     }
+    action.coordinates_to.y = (action.coordinates_from.y + offset_y) % height();
+    action.coordinates_to.x = (action.coordinates_from.x + offset_x) % width();
     return action;
 }
 
@@ -2,219 +2,623 @@
 
 #include "../rl/self_play.h"
 #include "../rl/train.h"
+#include "../rl/inference_server.h"
+#include "../rl/shared_inference.h"
+#include "../rl/self_play_checkpoint.h"
+#include "../rl/self_play_writer.h"
+#include "../util/checkpoint_watcher.h"
+#include "../util/fiber.h"
+#include "../util/thread_pool.h"
 
+#include <climits>
+#include <csignal>
 #include <memory>
 #include <utility>
 #include "../../third_party/queue/concurrentqueue.h"
-#include "../../third_party/queue/lightweightsemaphore.h"
 
 #include "jackal.h"
 #include "game_model.h"
+#include "quantized_model.h"
+#include "frozen_model.h"
+#include "engine_model.h"
 #include <filesystem>
 
 using namespace moodycamel;
 
-struct TModelJob {
-    torch::Tensor *state{nullptr};
-    GameModelOutput *output{nullptr};
-    LightweightSemaphore *semaphore{nullptr};
-};
+// libtorch fp32 model
+const int INFERENCE_BACKEND_TORCH = 0;
+
+// int8 post-training quantized model, CPU only
+const int INFERENCE_BACKEND_INT8 = 1;
+
+// fp32 model with BatchNorm folded into the convolutions
+const int INFERENCE_BACKEND_FROZEN = 2;
+
+// hand-written small-board convolution kernels, CPU only
+const int INFERENCE_BACKEND_ENGINE = 3;
 
-struct TTaskJob {
-    TTaskJob(Jackal game,
-             JackalModel model,
-             const std::unordered_map<std::string, float> &config,
-             SelfPlayResult &spr)
-            : jackal(std::move(game)),
-              model(std::move(model)),
-              config(config),
-              self_play_result(spr) {
+
+// Plays one game with every position evaluated through the inference server. Runs on a self-play ThreadPool
+// worker, either directly or as one of its fibers; the reply buffers belong to the game since fibers share a thread.
+// The result is tagged with the oldest model version that answered one of its requests.
+// A game resumed from a checkpoint passes its record so far as history; with progress set every move is recorded
+// under progress_id.
+// Resignation and draw adjudication follow the simulation_resign_* and simulation_draw_* keys; a
+// simulation_no_resign_fraction of the games is played out to measure how often resignation would be wrong.
+SelfPlayResult self_play_game(Jackal game, const std::unordered_map<std::string, float> &config,
+                              InferenceClient *inference, EvaluationCache *cache, std::atomic<int> *turns,
+                              TensorBoardLogger *logger, SelfPlayResult history = SelfPlayResult(),
+                              SelfPlayProgress *progress = nullptr, int progress_id = -1) {
+    InferenceReply reply;
+    SelfPlayAdjudication adjudication;
+    adjudication.resign_threshold = config.at("simulation_resign_threshold");
+    adjudication.resign_moves = int(config.at("simulation_resign_moves"));
+    adjudication.no_resign = rand01() < config.at("simulation_no_resign_fraction");
+    adjudication.draw_threshold = config.at("simulation_draw_threshold");
+    adjudication.draw_moves = int(config.at("simulation_draw_moves"));
+    int model_version = history.model_version >= 0 ? history.model_version : INT_MAX;
+    std::function<void(const Jackal &, const SelfPlayResult &)> on_turn;
+    if (progress) {
+        on_turn = [progress, progress_id, &model_version](const Jackal &game, const SelfPlayResult &record) {
+            progress->update(progress_id, game.get_state(), game.turn, record,
+                             model_version == INT_MAX ? -1 : model_version);
+        };
     }
+    auto result = mcts_model_self_play<>(
+            std::move(game),
+            [inference, cache, &config, &reply, &model_version](const Jackal &state) {
+                auto x = state.get_state();
+                uint64_t key = 0;
+                MCTSStateActionValue value;
+                if (cache) {
+                    key = hash_tensor(x);
+                    if (cache->get(key, value)) {
+                        return value;
+                    }
+                }
+                int priority = state.turn * 2 >= config.at("simulation_max_turns") ?
+                               INFERENCE_PRIORITY_LONG_GAME : INFERENCE_PRIORITY_SELF_PLAY;
+                inference->request(x, reply, priority);
+                model_version = std::min(model_version, reply.model_version);
+                value = to_state_action_value(&reply.value[0], (int) reply.value.size(),
+                                              reply.has_policy ? &reply.policy[0] : nullptr, state);
+                if (cache) {
+                    cache->put(key, value);
+                }
+                return value;
+            },
+            int(config.at("mcts_iterations")),
+            int(config.at("simulation_max_turns")),
+            config.at("simulation_temperature"),
+            config.at("mcts_exploration"),
+            config.at("enable_action_value") > 0 ? UCT_PUCT : UCT_UCB1,
+            turns,
+            logger,
+            false,
+            std::move(history),
+            on_turn,
+            adjudication
+    );
+    result.model_version = model_version == INT_MAX ? -1 : model_version;
+    return result;
+}
 
-    Jackal jackal;
-    JackalModel model;
-    const std::unordered_map<std::string, float> &config;
-    SelfPlayResult &self_play_result;
-};
+// Outcomes of adjudicated games. A false resignation is a calibration game where the player who would have resigned
+// did not lose; its rate over the calibration games tells whether simulation_resign_threshold is safe.
+struct AdjudicationStats {
+    std::atomic<long> games{0};
+    std::atomic<long> moves{0};
+    std::atomic<long> resigned{0};
+    std::atomic<long> draws{0};
+    std::atomic<long> calibration_games{0};
+    std::atomic<long> false_resignations{0};
+
+    void add(const SelfPlayResult &result) {
+        games++;
+        moves += (long) result.states.size();
+        if (result.resigned_player >= 0) {
+            resigned++;
+        }
+        if (result.adjudicated_draw) {
+            draws++;
+        }
+        int p = result.would_resign_player;
+        if (p >= 0) {
+            calibration_games++;
+            if (result.self_play_reward[p] > -1.f) {
+                false_resignations++;
+            }
+        }
+    }
 
-typedef ConcurrentQueue<std::unique_ptr<TTaskJob>> TTaskQueue;
-typedef ConcurrentQueue<TModelJob> TModelQueue;
+    void print() const {
+        if (games == 0) {
+            return;
+        }
+        std::cout << "Adjudication: " << games << " games, " << (float) moves / (float) games << " moves/game, "
+                  << resigned << " resigned, " << draws << " adjudicated draws";
+        if (calibration_games > 0) {
+            std::cout << ", false resignations " << false_resignations << "/" << calibration_games << " ("
+                      << 100.f * (float) false_resignations / (float) calibration_games << "%)";
+        }
+        std::cout << std::endl;
+    }
+};
 
+// Representative model inputs for quantization: states from the self-play files in dir, or from random games when
+// there are none yet.
+std::vector<torch::Tensor> load_calibration_batches(const std::string &dir, int width, int height, int players,
+                                                    int max_batches, int batch_size) {
+    std::vector<torch::Tensor> batches;
+    for (auto &fname : get_loadable_selfplay_files(dir)) {
+        SelfPlayDataset ds;
+        ds.load(fname);
+        for (auto &ex : ds.examples) {
+            if (batches.size() >= max_batches) {
+                return batches;
+            }
+            batches.push_back(ex.x);
+        }
+    }
+    while (batches.size() < max_batches) {
+        std::vector<torch::Tensor> states;
+        Jackal game(height, width, players);
+        while (states.size() < batch_size && !game.get_possible_actions().empty()) {
+            states.push_back(game.get_state());
+            game = game.take_action(game.get_random_action());
+        }
+        if (states.empty()) {
+            throw std::runtime_error("random games have no moves to calibrate the quantized model with");
+        }
+        batches.push_back(torch::cat({&states[0], states.size()}));
+    }
+    return batches;
+}
 
-void
-self_play_thread(int thread_num, TTaskQueue *task_queue, TModelQueue *model_queue, std::atomic<int> *jobs_completed,
-                 std::atomic<int> *turns, std::atomic<bool> *terminated, TensorBoardLogger *logger) {
+std::vector<InferenceModelPtr>
+make_inference_models(const std::string &dir, int width, int height, int players, JackalModel &model,
+                      const std::unordered_map<std::string, float> &config, int workers) {
     using namespace std;
-    LightweightSemaphore semaphore;
-    std::unique_ptr<TTaskJob> task;
-    cout << "[thread:" << thread_num << "] started thread" << endl;
-    while (!*terminated) {
-        while (!task_queue->try_dequeue(task)) {
-            if (*terminated) {
-                goto exit_thread;
+    std::vector<InferenceModelPtr> models;
+    int backend = int(config.at("inference_backend"));
+    if ((backend == INFERENCE_BACKEND_INT8 || backend == INFERENCE_BACKEND_ENGINE) && get_device(config).is_cuda()) {
+        throw std::runtime_error("inference_backend " + std::to_string(backend) +
+                                 " runs on CPU only, set device_cuda to 0");
+    }
+    switch (backend) {
+        case INFERENCE_BACKEND_TORCH: {
+            models.push_back(std::make_shared<TorchInferenceModel<JackalModel>>(model));
+            for (int i = 1; i < workers; ++i) {
+                models.push_back(std::make_shared<TorchInferenceModel<JackalModel>>(clone_model(model)));
+            }
+            break;
+        }
+        case INFERENCE_BACKEND_INT8: {
+            auto batches = load_calibration_batches(dir, width, height, players,
+                                                    int(config.at("quantization_calibration_batches")),
+                                                    int(config.at("train_batch_size")));
+            auto quantized = std::make_shared<QuantizedJackalModel>(model);
+            quantized->calibrate(batches);
+            cout << "Quantized model accuracy: " << quantized->evaluate(model, batches) << endl;
+            // prepacked weights are only read during forward, the workers can share them
+            for (int i = 0; i < workers; ++i) {
+                models.push_back(quantized);
+            }
+            break;
+        }
+        case INFERENCE_BACKEND_FROZEN: {
+            auto frozen = std::make_shared<FrozenJackalModel>(model);
+            for (int i = 0; i < workers; ++i) {
+                models.push_back(frozen);
+            }
+            break;
+        }
+        case INFERENCE_BACKEND_ENGINE: {
+            auto engine = std::make_shared<EngineJackalModel>(model);
+            cout << "ResNetEngine kernels: " << ResNetEngine::kernels() << endl;
+            for (int i = 0; i < workers; ++i) {
+                models.push_back(engine);
             }
+            break;
         }
-//        cout << "[thread:" << thread_num << "] started task" << endl;
-        auto &config(task->config);
-        task->self_play_result = mcts_model_self_play<>(
-                task->jackal,
-                [thread_num, model_queue, &semaphore](const Jackal &state) {
-                    auto x = state.get_state();
-                    GameModelOutput output;
-                    TModelJob item{&x, &output, &semaphore};
-                    model_queue->enqueue(item);
-                    semaphore.wait();
-                    return to_state_action_value(output, state);
-                },
-                int(config.at("mcts_iterations")),
-                int(config.at("simulation_max_turns")),
-                config.at("simulation_temperature"),
-                config.at("mcts_exploration"),
-                config.at("enable_action_value") > 0 ? UCT_PUCT : UCT_UCB1,
-                turns,
-                logger
-        );
-        (*jobs_completed)++;
-//        cout << "[thread:" << thread_num << "] finished task" << endl;
+        default:
+            throw std::runtime_error("Unsupported inference_backend value");
+    }
+    return models;
+}
+
+// Inference server for self-play, configured by the device_cuda and inference_* options
+std::unique_ptr<InferenceServer>
+make_inference_server(const std::string &dir, int width, int height, int players, JackalModel &model,
+                      const std::unordered_map<std::string, float> &config, TModelQueue &model_queue) {
+    using namespace std;
+    auto device = get_device(config);
+    int workers = std::max(1, int(config.at("inference_workers")));
+    int threads_per_worker = int(config.at("inference_threads_per_worker"));
+    if (device.is_cpu() && threads_per_worker <= 0) {
+        // split the cores between the CPU replicas instead of letting each of them grab all of them
+        threads_per_worker = std::max(1, int(std::thread::hardware_concurrency()) / workers);
+    }
+    cout << "Inference on " << device << " with " << workers << " workers, " << threads_per_worker
+         << " threads per worker" << endl;
+    return std::make_unique<InferenceServer>(make_inference_models(dir, width, height, players, model, config, workers),
+                                             model_queue, device,
+                                             int(config.at("inference_max_batch_size")),
+                                             int(config.at("inference_max_wait_us")),
+                                             int(config.at("inference_pipeline_buffers")),
+                                             threads_per_worker);
+}
+
+// null when inference_cache_size is 0
+std::unique_ptr<EvaluationCache> make_evaluation_cache(const std::unordered_map<std::string, float> &config) {
+    std::unique_ptr<EvaluationCache> cache;
+    if (config.at("inference_cache_size") > 0) {
+        cache.reset(new EvaluationCache((size_t) config.at("inference_cache_size"),
+                                        int(config.at("inference_cache_shards"))));
     }
-    exit_thread:
-    cout << "[thread:" << thread_num << "] exit thread" << endl;
+    return cache;
 }
 
-struct RequestContext {
-    std::vector<TModelJob> items;
-    torch::Tensor batch;
-    GameModelOutput model_output;
+// stats is null when inference runs in another process
+void print_self_play_progress(int games, int turns, const InferenceStats *stats, long &prev_requests,
+                              const EvaluationCache *cache) {
+    using namespace std;
+    cout << "Simulations completed: " << games << ". Total turns:" << turns;
+    if (stats) {
+        long total_requests = stats->requests;
+        cout << ". Total requests served: " << total_requests << ". Requests per second: "
+             << (total_requests - prev_requests) << ". Mean batch size: " << stats->mean_batch_size();
+        prev_requests = total_requests;
+    }
+    if (cache) {
+        cout << ". Cache hit rate: " << cache->hit_rate();
+    }
+    cout << endl;
+}
+
+void print_inference_summary(const std::string &dir, const InferenceStats *stats, const EvaluationCache *cache) {
+    using namespace std;
+    if (stats) {
+        stats->print(cout);
+        std::ofstream stats_file(dir + "/inference_stats.txt", std::ios::app);
+        stats->print(stats_file);
+    }
+    if (cache) {
+        cout << "Evaluation cache hits: " << cache->hits << ". Misses: " << cache->misses << ". Hit rate: "
+             << cache->hit_rate() << endl;
+    }
+}
+
+// Hot reload of the checkpoint jackal_train writes to dir/model.bin.trained. poll() loads a new checkpoint on the
+// calling thread, builds replicas for the configured backend and hands them to the server, which switches between
+// batches; in-flight games carry on with the new weights.
+class ModelReloader {
+    CheckpointWatcher watcher;
+    std::string dir;
+    int width;
+    int height;
+    int players;
+    JackalModel &model;
+    const std::unordered_map<std::string, float> &config;
+
+public:
+    ModelReloader(const std::string &dir, int width, int height, int players, JackalModel &model,
+                  const std::unordered_map<std::string, float> &config) :
+            watcher(dir + "/model.bin.trained"), dir(dir), width(width), height(height), players(players),
+            model(model), config(config) {
+    }
 
-    bool empty() const {
-        return items.empty();
+    // returns true when server has been given a new model
+    bool poll(InferenceServer &server) {
+        if (!watcher.poll()) {
+            return false;
+        }
+        try {
+            JackalModel next = clone_model(model);
+            torch::load(next, watcher.get_path());
+            int version = server.model_version + 1;
+            server.swap_models(make_inference_models(dir, width, height, players, next, config,
+                                                     server.worker_count()), version);
+            watcher.mark_seen();
+            std::cout << "Loaded model version " << version << " from " << watcher.get_path() << std::endl;
+            return true;
+        } catch (const std::exception &e) {
+            std::cerr << "Failed to reload " << watcher.get_path() << ": " << e.what() << std::endl;
+            return false;
+        }
     }
 };
 
+// Inference behind a self-play run: an InferenceServer thread in this process or, with inference_shared_memory set,
+// the jackal_inference_server process serving the same dir.
+class SelfPlayInference {
+    TModelQueue model_queue{INFERENCE_PRIORITY_LEVELS};
+    std::unique_ptr<InferenceServer> server;
+    std::unique_ptr<InferenceClient> inference_client;
+    SharedInferenceClient *shared_client{nullptr};
+    std::unique_ptr<ModelReloader> reloader;
+    int cache_version{0};
+    std::atomic<bool> terminated{false};
+    std::thread model_thread;
 
-bool read_request(TModelQueue &queue, RequestContext &request, std::atomic<bool> *terminated) {
-    auto &items = request.items;
-    items.clear();
-    TModelJob item{};
-    while (items.empty() && !*terminated) {
-        while (queue.try_dequeue(item) && !*terminated) {
-            items.push_back(item);
+public:
+    SelfPlayInference(const std::string &dir, int width, int height, int players, JackalModel &model,
+                      const std::unordered_map<std::string, float> &config) {
+        if (config.at("inference_shared_memory") > 0) {
+            auto name = shared_inference_name(dir);
+            std::cout << "Inference on the shared memory server " << name << std::endl;
+            shared_client = new SharedInferenceClient(name);
+            inference_client.reset(shared_client);
+            cache_version = shared_client->model_version();
+        } else {
+            server = make_inference_server(dir, width, height, players, model, config, model_queue);
+            inference_client.reset(new QueueInferenceClient(model_queue));
+            if (config.at("simulation_model_reload") > 0) {
+                reloader.reset(new ModelReloader(dir, width, height, players, model, config));
+            }
+            model_thread = std::thread(&InferenceServer::run, server.get(), &terminated);
         }
     }
-    if (!items.empty()) {
-        std::vector<torch::Tensor> states;
-        for (auto &i : items) {
-            states.push_back(*i.state);
+
+    ~SelfPlayInference() {
+        stop();
+    }
+
+    InferenceClient *client() {
+        return inference_client.get();
+    }
+
+    // Called from the progress loops, off the search threads: reloads a new checkpoint into the in-process server when
+    // simulation_model_reload is set, and empties cache once the model serving this process has changed. Values
+    // of the previous model still in flight may be cached right after that.
+    void poll_model(EvaluationCache *cache) {
+        int version = cache_version;
+        if (reloader && reloader->poll(*server)) {
+            version = server->model_version;
+        } else if (shared_client) {
+            version = shared_client->model_version();
+        }
+        if (version != cache_version) {
+            cache_version = version;
+            if (cache) {
+                cache->clear();
+            }
         }
-        request.batch = torch::cat({&states[0], states.size()}).to(torch::kCUDA);
     }
-    return !items.empty();
-}
 
-void reply(RequestContext &request) {
-    auto &items(request.items);
-    auto &model_output(request.model_output);
-    bool action_value_enabled = model_output.policy.numel() > 0;
-    if (action_value_enabled)
-        model_output.policy = model_output.policy.to(torch::kCPU);
-    model_output.value = model_output.value.to(torch::kCPU);
-    for (int i = 0; i < items.size(); ++i) {
-        if (action_value_enabled)
-            items[i].output->policy = model_output.policy.index({i, "..."}).unsqueeze(0);
-        items[i].output->value = model_output.value.index({i, "..."}).unsqueeze(0);
-        items[i].semaphore->signal();
+    // statistics of the in-process server, null when inference runs in another process
+    const InferenceStats *stats() const {
+        return server ? &server->stats : nullptr;
     }
-}
 
+    // reporter for stats(), null when inference runs in another process
+    std::unique_ptr<InferenceStatsReporter> reporter(const std::string &dir, TensorBoardLogger *logger) const {
+        std::unique_ptr<InferenceStatsReporter> r;
+        if (server) {
+            r.reset(new InferenceStatsReporter(server->stats, logger, dir + "/inference_stats.txt"));
+        }
+        return r;
+    }
 
-void model_loop(JackalModel model, TModelQueue *queue, std::atomic<bool> *terminated, int *total_requests) {
-    time_t tm;
-    time(&tm);
-    RequestContext cur_request;
-    torch::NoGradGuard no_grad;
-    model->eval();
-    model->to(torch::kCUDA);
-    while (!*terminated) {
-        TModelJob item;
-        if (read_request(*queue, cur_request, terminated)) {
-            cur_request.model_output = (model)(cur_request.batch);
-            reply(cur_request);
-            (*total_requests) += cur_request.items.size();
+    void stop() {
+        terminated = true;
+        if (model_thread.joinable()) {
+            model_thread.join();
         }
     }
-}
+};
 
-int persist_completed_selfplays(const std::string &dir, std::vector<SelfPlayResult> &selfplays, int batch_size,
-                                float sampling) {
-    std::vector<SelfPlayResult> tmp_results;
-    int jobs_persisted = 0;
-    int jobs_found = 0;
-    for (auto &self_play : selfplays) {
-        if (!self_play.states.empty()) {
-            jobs_found++;
-//            if (abs(self_play.self_play_reward[0]) > 1e-5) {
-                tmp_results.push_back(std::move(self_play));
-                jobs_persisted++;
-//            } else {
-//                self_play = SelfPlayResult();
-//            }
+// Runs play_games once per pool thread or, when simulation_fibers is set, simulation_fibers times per pool thread as
+// fibers. play_games keeps taking games until there are none left; with fibers every pool thread keeps that many
+// games in flight while blocking only when all of them wait on the inference server.
+void submit_self_play_workers(ThreadPool *pool, const std::unordered_map<std::string, float> &config,
+                              const std::function<void()> &play_games) {
+    int fibers = int(config.at("simulation_fibers"));
+    for (int i = 0; i < pool->size(); ++i) {
+        if (fibers > 0) {
+            pool->submit([fibers, &play_games]() {
+                // the fibers interleave their grad mode guards, keep them all nested in this one
+                torch::NoGradGuard no_grad;
+                FiberScheduler scheduler;
+                for (int f = 0; f < fibers; ++f) {
+                    scheduler.spawn(play_games);
+                }
+                scheduler.run();
+            });
+        } else {
+            pool->submit(play_games);
         }
     }
-    SelfPlayDataset ds(tmp_results, batch_size, true, torch::kCPU, sampling);
-    ds.save_to_dir(dir);
-    std::cout << "Persisted " << jobs_persisted << " out of " << jobs_found << std::endl;
-    return jobs_persisted;
 }
 
+// Continues a checkpointed game on a fresh board
+Jackal restore_game(const GameInProgress &saved, int width, int height, int players, bool render) {
+    Jackal game(height, width, players, render, render);
+    torch::Tensor state = saved.state[0].clone();
+    game.load(state);
+    game.turn = saved.turn;
+    return game;
+}
+
+const std::string SELF_PLAY_CHECKPOINT_FILE = "self_play_checkpoint.bin";
+
+// Runs one cycle of simulation_cycle_games self-play games on pool, or on a pool of simulation_threads workers
+// created for this call when pool is null. Finished games go to a SelfPlayWriter, which persists them in files of
+// simulation_persist_batch_size games from its own thread and holds back the games once simulation_writer_queue of
+// them wait to be written.
+// Every simulation_checkpoint_seconds the finished games are flushed and the games in progress saved to
+// dir/self_play_checkpoint.bin; with simulation_resume set, an interrupted cycle continues from that checkpoint.
 void multithreaded_self_plays(const std::string &dir, int width, int height, JackalModel &model,
-                              const std::unordered_map<std::string, float> &config, int players) {
+                              const std::unordered_map<std::string, float> &config, int players,
+                              ThreadPool *pool = nullptr) {
     using namespace std;
-    TTaskQueue task_queue;
-    TModelQueue model_queue;
-
-    std::vector<SelfPlayResult> self_plays;
-    self_plays.resize(int(config.at("simulation_cycle_games")));
-    std::cout << "Running " << self_plays.size() << " simulations" << std::endl;
-    for (auto &self_play : self_plays) {
-        task_queue.enqueue(
-                std::make_unique<TTaskJob>(Jackal(height, width, players, config.at("simulation_render") > 0,
-                                                  config.at("simulation_render") > 0), model,
-                                           config, self_play));
+    std::unique_ptr<ThreadPool> own_pool;
+    if (!pool) {
+        own_pool.reset(new ThreadPool(int(config.at("simulation_threads"))));
+        pool = own_pool.get();
     }
-    std::atomic<bool> terminated(false);
+    auto checkpoint_path = dir + "/" + SELF_PLAY_CHECKPOINT_FILE;
+    SelfPlayCheckpoint resumed;
+    if (config.at("simulation_resume") > 0 && resumed.load(checkpoint_path)) {
+        std::cout << "Resuming from " << checkpoint_path << ": " << resumed.games_completed << " games completed, "
+                  << resumed.games.size() << " in progress" << std::endl;
+    }
+    int total_games = std::max<int>(int(config.at("simulation_cycle_games")) - resumed.games_completed,
+                                    (int) resumed.games.size());
+    std::cout << "Running " << total_games << " simulations on " << pool->size() << " threads";
+    if (config.at("simulation_fibers") > 0) {
+        std::cout << " with " << int(config.at("simulation_fibers")) << " fibers each";
+    }
+    std::cout << std::endl;
+    SelfPlayInference inference(dir, width, height, players, model, config);
+
     std::atomic<int> jobs_completed(0);
+    std::atomic<int> next_game(0);
     std::atomic<int> turns(0);
-    int num_threads = int(config.at("simulation_threads"));
-    std::vector<std::thread> sim_threads;
-    sim_threads.reserve(num_threads);
     auto logger = gen_logger();
-    for (int i = 0; i < num_threads; ++i) {
-        sim_threads.emplace_back(
-                std::thread(self_play_thread, i, &task_queue, &model_queue, &jobs_completed, &turns, &terminated,
-                            self_plays.size() > 1 ? nullptr : &logger));
+    auto cache = make_evaluation_cache(config);
+    auto stats_reporter = inference.reporter(dir, &logger);
+    TensorBoardLogger *game_logger = total_games > 1 ? nullptr : &logger;
+    SelfPlayWriter writer(dir, int(config.at("simulation_persist_batch_size")), int(config.at("train_batch_size")),
+                          config.at("simulation_persist_sampling_rate"), int(config.at("simulation_writer_queue")));
+    // finished games move into the writer and out of progress under results_mutex, so that a checkpoint sees every
+    // game exactly once
+    std::mutex results_mutex;
+    SelfPlayProgress progress;
+    AdjudicationStats adjudication;
+    auto play_games = [&, game_logger]() {
+        bool render = config.at("simulation_render") > 0;
+        for (int i = next_game++; i < total_games; i = next_game++) {
+            GameInProgress start;
+            if (i < resumed.games.size()) {
+                start = resumed.games[i];
+            }
+            Jackal game = start.state.defined() ? restore_game(start, width, height, players, render)
+                                                : Jackal(height, width, players, render, render);
+            int id = progress.start(GameInProgress{game.get_state(), game.turn, start.history});
+            auto result = self_play_game(std::move(game), config, inference.client(), cache.get(), &turns,
+                                         game_logger, std::move(start.history), &progress, id);
+            adjudication.add(result);
+            std::lock_guard<std::mutex> lock(results_mutex);
+            writer.add(std::move(result));
+            jobs_completed++;
+            progress.finish(id);
+        }
+    };
+    submit_self_play_workers(pool, config, play_games);
+    long prev_requests = 0;
+    float checkpoint_seconds = config.at("simulation_checkpoint_seconds");
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    while (jobs_completed < total_games) {
+        sleep(1);
+        print_self_play_progress(jobs_completed, turns, inference.stats(), prev_requests, cache.get());
+        inference.poll_model(cache.get());
+        if (stats_reporter) {
+            stats_reporter->report();
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (checkpoint_seconds > 0 &&
+            std::chrono::duration<float>(now - last_checkpoint).count() >= checkpoint_seconds) {
+            std::lock_guard<std::mutex> lock(results_mutex);
+            writer.flush();
+            SelfPlayCheckpoint checkpoint;
+            checkpoint.games_completed = resumed.games_completed + jobs_completed;
+            checkpoint.games = progress.snapshot();
+            checkpoint.save(checkpoint_path);
+            std::cout << "Checkpoint: " << checkpoint.games_completed << " games completed, "
+                      << checkpoint.games.size() << " in progress" << std::endl;
+            last_checkpoint = now;
+        }
+    }
+    pool->wait_idle();
+    writer.close();
+    // the cycle is complete, a later run must not resume it
+    std::filesystem::remove(checkpoint_path);
+    inference.stop();
+    adjudication.print();
+    print_inference_summary(dir, inference.stats(), cache.get());
+}
+
+
+// set by SIGINT/SIGTERM while streaming_self_plays runs
+inline std::atomic<bool> self_play_interrupted{false};
+
+inline void self_play_interrupt_handler(int) {
+    self_play_interrupted = true;
+}
+
+// Plays games continuously instead of in fixed cycles: every pool worker starts a new game as soon as its previous
+// one ends, so the inference server never drains between cycles, and finished games are persisted by a background
+// SelfPlayWriter in files of simulation_persist_batch_size games. Stops after simulation_stream_games games or
+// simulation_stream_seconds seconds (0 means unlimited), or on SIGINT/SIGTERM; games in progress are completed and
+// written before returning.
+void streaming_self_plays(const std::string &dir, int width, int height, JackalModel &model,
+                          const std::unordered_map<std::string, float> &config, int players,
+                          ThreadPool *pool = nullptr) {
+    using namespace std;
+    std::unique_ptr<ThreadPool> own_pool;
+    if (!pool) {
+        own_pool.reset(new ThreadPool(int(config.at("simulation_threads"))));
+        pool = own_pool.get();
     }
-    int total_requests = 0;
-    std::thread model_thread(model_loop, model, &model_queue, &terminated, &total_requests);
-    int prev_requests = 0;
-    int jobs_persisted = 0;
-    while (jobs_completed < self_plays.size()) {
+    SelfPlayInference inference(dir, width, height, players, model, config);
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> games_started(0);
+    std::atomic<int> games_completed(0);
+    std::atomic<int> turns(0);
+    int max_games = int(config.at("simulation_stream_games"));
+    float max_seconds = config.at("simulation_stream_seconds");
+    auto logger = gen_logger();
+    auto cache = make_evaluation_cache(config);
+    SelfPlayWriter writer(dir, int(config.at("simulation_persist_batch_size")), int(config.at("train_batch_size")),
+                          config.at("simulation_persist_sampling_rate"), int(config.at("simulation_writer_queue")));
+    auto stats_reporter = inference.reporter(dir, &logger);
+    AdjudicationStats adjudication;
+
+    self_play_interrupted = false;
+    auto old_sigint = std::signal(SIGINT, self_play_interrupt_handler);
+    auto old_sigterm = std::signal(SIGTERM, self_play_interrupt_handler);
+    std::cout << "Streaming simulations on " << pool->size() << " threads" << std::endl;
+    auto play_games = [&]() {
+        bool render = config.at("simulation_render") > 0;
+        while (!stop && (max_games <= 0 || games_started++ < max_games)) {
+            auto result = self_play_game(Jackal(height, width, players, render, render), config,
+                                         inference.client(), cache.get(), &turns, nullptr);
+            adjudication.add(result);
+            writer.add(std::move(result));
+            games_completed++;
+        }
+    };
+    submit_self_play_workers(pool, config, play_games);
+    auto start = std::chrono::steady_clock::now();
+    long prev_requests = 0;
+    while (pool->pending_tasks() > 0) {
         sleep(1);
-        cout << "Simulations completed: " << jobs_completed << ". Total turns:" << turns << ". Total requests served: "
-             << total_requests << ". Requests per second: " << (total_requests - prev_requests) << endl;
-        if (jobs_completed - jobs_persisted >= config.at("simulation_persist_batch_size")) {
-            persist_completed_selfplays(dir, self_plays, (int) config.at("train_batch_size"),
-                                        config.at("simulation_persist_sampling_rate"));
-            jobs_persisted = jobs_completed;
+        print_self_play_progress(games_completed, turns, inference.stats(), prev_requests, cache.get());
+        inference.poll_model(cache.get());
+        if (stats_reporter) {
+            stats_reporter->report();
+        }
+        float elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+        if (!stop && (self_play_interrupted || (max_seconds > 0 && elapsed >= max_seconds))) {
+            std::cout << "Stopping, waiting for the games in progress" << std::endl;
+            stop = true;
+            // a second signal falls back to the previous behaviour
+            std::signal(SIGINT, old_sigint);
+            std::signal(SIGTERM, old_sigterm);
         }
-        prev_requests = total_requests;
     }
-    persist_completed_selfplays(dir, self_plays, (int) config.at("train_batch_size"),
-                                config.at("simulation_persist_sampling_rate"));
-    terminated = true;
-    for (auto &t: sim_threads) {
-        t.join();
+    pool->wait_idle();
+    if (!stop) {
+        std::signal(SIGINT, old_sigint);
+        std::signal(SIGTERM, old_sigterm);
     }
-    model_thread.join();
+    writer.close();
+    inference.stop();
+    std::cout << "Games written: " << writer.games_written() << std::endl;
+    adjudication.print();
+    print_inference_summary(dir, inference.stats(), cache.get());
 }
 
 
@@ -222,30 +626,57 @@ float
 jackal_train(const std::string &dir, const std::unordered_map<std::string, float> &config_map, int width = 7,
              int height = 7, int players = 2) {
     using namespace std;
-    auto device = torch::kCUDA;
+    auto device = get_device(config_map);
     Jackal game(height, width, players);
     const at::Tensor &game_state = game.get_state().squeeze(0);
     c10::IntArrayRef dim = game_state.sizes();
     int channels = dim[0];
-    JackalModel model(c10::IntArrayRef{1, channels, height, width});
-    model->to(device);
-    JackalModel baseline_model(c10::IntArrayRef{1, channels, height, width});
-    baseline_model->to(device);
-
     std::unordered_map<std::string, float> config(config_map);
     // TODO tune up hyperparams
     std::unordered_map<std::string, float> default_config{
             {"train_learning_rate",         1e-4},
             {"train_l2_regularization",     0},
-            {"train_replay_buffer",         1 >> 16},
+            {"train_replay_buffer",         1 << 16},
+            {"train_replay_version_decay",  1.},
             {"train_epochs",                1},
             {"train_batch_size",            128},
+            {"train_loader_threads",        2},
+            {"train_prefetch_batches",      64},
 
             {"simulation_cycle_games",      5000},
             {"simulation_cycles",           1000},
             {"simulation_temperature",      0.5},
             {"simulation_threads",          64},
             {"simulation_max_turns",        1000},
+            {"simulation_fibers",           0},
+            {"simulation_model_reload",     0},
+            {"simulation_checkpoint_seconds", 0},
+            {"simulation_resume",           0},
+            {"simulation_writer_queue",     64},
+            {"simulation_resign_threshold", -0.9},
+            {"simulation_resign_moves",     0},
+            {"simulation_no_resign_fraction", 0.1},
+            {"simulation_draw_threshold",   0.05},
+            {"simulation_draw_moves",       0},
+            {"simulation_streaming",        0},
+            {"simulation_stream_games",     0},
+            {"simulation_stream_seconds",   0},
+
+            {"inference_max_batch_size",    256},
+            {"inference_max_wait_us",       1000},
+            {"inference_pipeline_buffers",  2},
+            {"inference_workers",           1},
+            {"inference_threads_per_worker", 0},
+            {"inference_cache_size",        1 << 18},
+            {"inference_cache_shards",      64},
+            {"inference_backend",           0},
+            {"inference_shared_memory",     0},
+            {"inference_shared_slots",      4096},
+            {"quantization_calibration_batches", 16},
+
+            {"policy_head",                 0},
+
+            {"device_cuda",                 -1},
 
             {"mcts_iterations_first_cycle", 1},
             {"mcts_iterations",             256},
@@ -261,18 +692,26 @@ jackal_train(const std::string &dir, const std::unordered_map<std::string, float
             config[kv.first] = kv.second;
         }
     }
-    Trainer<Jackal, JackalModel> trainer(config, torch::kCUDA);
+    int policy_head = (int) config.at("policy_head");
+    JackalModel model(c10::IntArrayRef{1, channels, height, width}, 128, 10, players, true, policy_head);
+    model->to(device);
+    JackalModel baseline_model(c10::IntArrayRef{1, channels, height, width}, 128, 10, players, true, policy_head);
+    baseline_model->to(device);
+
+    Trainer<Jackal, JackalModel> trainer(config, device);
+    // self-play workers are started once and reused by every cycle
+    ThreadPool self_play_pool(int(config.at("simulation_threads")));
     auto result = trainer.simulate_and_train(
             dir,
             model,
             baseline_model,
             nullptr,
-            [height, width, players](
+            [height, width, players, &self_play_pool](
                     const std::string &dir,
                     JackalModel &model,
                     const std::unordered_map<std::string, float> &config
             ) {
-                return multithreaded_self_plays(dir, width, height, model, config, players);
+                return multithreaded_self_plays(dir, width, height, model, config, players, &self_play_pool);
             }
     );
 
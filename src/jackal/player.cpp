@@ -2,8 +2,9 @@
 
 using namespace torch::indexing;
 
-Player::Player(int player_idx) : player_idx(player_idx) {
-
+Player::Player(int player_idx) :
+        player_idx(player_idx),
+        actions_cache(new std::unordered_map<Action, std::unordered_set<Action>>()) {
 }
 
 Player::Player(int player_idx, int w, int h, bool render, bool debug) :
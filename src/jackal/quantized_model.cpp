@@ -0,0 +1,237 @@
+#include "quantized_model.h"
+
+#include <ATen/core/dispatch/Dispatcher.h>
+#include <ATen/core/stack.h>
+
+namespace {
+
+    c10::IValue call_op(const char *name, const char *overload, torch::jit::Stack stack) {
+        auto op = c10::Dispatcher::singleton().findSchemaOrThrow(name, overload);
+        op.callBoxed(&stack);
+        return stack[0];
+    }
+
+    QuantizedConv make_conv(torch::nn::Conv2d &conv, torch::nn::BatchNorm2d &batch_norm) {
+        QuantizedConv result;
+        std::tie(result.weight, result.bias) = fold_batch_norm(conv, batch_norm);
+        result.padding = result.weight.size(2) / 2;
+        return result;
+    }
+
+    QuantizedConv make_conv(torch::nn::Conv2d &conv) {
+        QuantizedConv result;
+        result.weight = conv->weight.detach().clone();
+        result.bias = conv->bias.detach().clone();
+        result.padding = result.weight.size(2) / 2;
+        return result;
+    }
+
+    QuantizedLinear make_linear(torch::nn::Linear &linear) {
+        return QuantizedLinear{linear->weight.detach().clone(), linear->bias.detach().clone(), c10::IValue()};
+    }
+
+    torch::Tensor conv_float(const QuantizedConv &conv, const torch::Tensor &x) {
+        return torch::conv2d(x, conv.weight, conv.bias, 1, conv.padding);
+    }
+
+    torch::Tensor conv_quantized(const QuantizedConv &conv, const torch::Tensor &qx, const ActivationObserver &output,
+                                 bool relu) {
+        return call_op(relu ? "quantized::conv2d_relu" : "quantized::conv2d", "new",
+                       {qx, conv.packed, output.scale(), output.zero_point()}).toTensor();
+    }
+
+    torch::Tensor linear_quantized(const QuantizedLinear &linear, const torch::Tensor &qx,
+                                   const ActivationObserver &output, bool relu) {
+        return call_op(relu ? "quantized::linear_relu" : "quantized::linear", "",
+                       {qx, linear.packed, output.scale(), output.zero_point()}).toTensor();
+    }
+
+    torch::Tensor flatten(const torch::Tensor &x) {
+        // quantized convolutions produce channels-last tensors, flatten in the NCHW order the linear layers expect
+        return x.contiguous().reshape({x.size(0), -1});
+    }
+
+    torch::Tensor flatten_planes(const torch::Tensor &x) {
+        // factorized policy planes [batch, offset * 2 + with_items, y, x] in action code order
+        return x.permute({0, 2, 3, 1}).reshape({x.size(0), -1});
+    }
+
+    torch::Tensor track(ActivationObserver &observer, const torch::Tensor &x, bool observe) {
+        if (observe) {
+            observer.observe(x);
+        }
+        return x;
+    }
+}
+
+void ActivationObserver::observe(const torch::Tensor &x) {
+    min = std::min(min, x.min().item<float>());
+    max = std::max(max, x.max().item<float>());
+}
+
+double ActivationObserver::scale() const {
+    return std::max((double) (max - min) / 255., 1e-8);
+}
+
+int64_t ActivationObserver::zero_point() const {
+    return std::min((int64_t) 255, std::max((int64_t) 0, (int64_t) std::round(-min / scale())));
+}
+
+std::ostream &operator<<(std::ostream &os, const QuantizationReport &r) {
+    return os << "QuantizationReport(samples: " << r.samples << ", value_mse: " << r.value_mse << ", policy_kl: "
+              << r.policy_kl << ")";
+}
+
+QuantizedJackalModel::QuantizedJackalModel(JackalModel &model) :
+        action_value(model->action_value), policy_head_type(model->policy_head_type) {
+    torch::NoGradGuard no_grad;
+    // folds a CPU copy, the caller's model keeps its device and training mode
+    JackalModel cpu_model = clone_model(model);
+    cpu_model->eval();
+    conv = make_conv(cpu_model->conv->conv2d, cpu_model->conv->batch_norm);
+    for (auto &res_model : cpu_model->res_models) {
+        QuantizedResBlock block;
+        block.conv1 = make_conv(res_model->conv->conv2d, res_model->conv->batch_norm);
+        block.conv2 = make_conv(res_model->conv2d, res_model->batch_norm);
+        blocks.push_back(block);
+    }
+    value_conv = make_conv(cpu_model->value_head->conv2d, cpu_model->value_head->batch_norm);
+    value_linear = make_linear(cpu_model->value_head->linear1);
+    value_output = make_linear(cpu_model->value_head->latent_state);
+    if (action_value && policy_head_type == POLICY_HEAD_FACTORIZED) {
+        auto &head = cpu_model->factorized_policy_head;
+        policy_conv = make_conv(head->conv2d, head->batch_norm);
+        policy_output = make_conv(head->output);
+    } else if (action_value) {
+        policy_conv = make_conv(cpu_model->policy_head->conv2d, cpu_model->policy_head->batch_norm);
+        policy_linear = make_linear(cpu_model->policy_head->linear);
+    }
+}
+
+GameModelOutput QuantizedJackalModel::forward_float(const torch::Tensor &batch, bool observe) {
+    torch::NoGradGuard no_grad;
+    auto x = track(input_observer, batch.to(torch::kFloat), observe);
+    x = track(conv_observer, torch::relu(conv_float(conv, x)), observe);
+    for (auto &block : blocks) {
+        auto y = track(block.hidden, torch::relu(conv_float(block.conv1, x)), observe);
+        y = track(block.branch, conv_float(block.conv2, y), observe);
+        x = track(block.output, torch::relu(y + x), observe);
+    }
+    auto v = track(value_conv_observer, torch::relu(conv_float(value_conv, x)), observe);
+    v = track(value_linear_observer, torch::relu(torch::linear(flatten(v), value_linear.weight, value_linear.bias)),
+              observe);
+    v = track(value_output_observer, torch::linear(v, value_output.weight, value_output.bias), observe);
+    torch::Tensor policy;
+    if (action_value && policy_head_type == POLICY_HEAD_FACTORIZED) {
+        auto p = track(policy_conv_observer, torch::relu(conv_float(policy_conv, x)), observe);
+        p = track(policy_output_observer, conv_float(policy_output, p), observe);
+        policy = torch::log_softmax(flatten_planes(p), 1);
+    } else if (action_value) {
+        auto p = track(policy_conv_observer, torch::relu(conv_float(policy_conv, x)), observe);
+        p = track(policy_linear_observer, torch::linear(flatten(p), policy_linear.weight, policy_linear.bias),
+                  observe);
+        policy = torch::log_softmax(p, 1);
+    }
+    return GameModelOutput{policy, torch::tanh(v)};
+}
+
+void QuantizedJackalModel::prepack() {
+    at::globalContext().setQEngine(at::QEngine::FBGEMM);
+    auto prepack_conv = [](QuantizedConv &c) {
+        auto scales = (c.weight.abs().amax({1, 2, 3}).clamp_min(1e-8) / 127.).to(torch::kDouble);
+        auto zero_points = torch::zeros({c.weight.size(0)}, torch::kLong);
+        auto weight = torch::quantize_per_channel(c.weight, scales, zero_points, 0, torch::kQInt8);
+        c.packed = call_op("quantized::conv2d_prepack", "",
+                           {weight, c.bias, c10::List<int64_t>({1, 1}), c10::List<int64_t>({c.padding, c.padding}),
+                            c10::List<int64_t>({1, 1}), (int64_t) 1});
+    };
+    auto prepack_linear = [](QuantizedLinear &l) {
+        double scale = std::max(l.weight.abs().max().item<double>(), 1e-8) / 127.;
+        auto weight = torch::quantize_per_tensor(l.weight, scale, 0, torch::kQInt8);
+        l.packed = call_op("quantized::linear_prepack", "", {weight, l.bias});
+    };
+    prepack_conv(conv);
+    for (auto &block : blocks) {
+        prepack_conv(block.conv1);
+        prepack_conv(block.conv2);
+    }
+    prepack_conv(value_conv);
+    prepack_linear(value_linear);
+    prepack_linear(value_output);
+    if (action_value && policy_head_type == POLICY_HEAD_FACTORIZED) {
+        prepack_conv(policy_conv);
+        prepack_conv(policy_output);
+    } else if (action_value) {
+        prepack_conv(policy_conv);
+        prepack_linear(policy_linear);
+    }
+}
+
+void QuantizedJackalModel::calibrate(const std::vector<torch::Tensor> &batches) {
+    if (batches.empty()) {
+        throw std::runtime_error("no calibration data for the quantized model");
+    }
+    for (auto &batch : batches) {
+        forward_float(batch, true);
+    }
+    prepack();
+    calibrated = true;
+}
+
+QuantizationReport QuantizedJackalModel::evaluate(JackalModel &model, const std::vector<torch::Tensor> &batches) {
+    torch::NoGradGuard no_grad;
+    JackalModel cpu_model = clone_model(model);
+    cpu_model->eval();
+    QuantizationReport report;
+    double value_se = 0;
+    double policy_kl = 0;
+    for (auto &batch : batches) {
+        auto expected = cpu_model(batch);
+        auto actual = forward(batch);
+        value_se += (expected.value - actual.value).pow(2).mean(1).sum().item<double>();
+        if (action_value) {
+            policy_kl += (expected.policy.exp() * (expected.policy - actual.policy)).sum(1).sum().item<double>();
+        }
+        report.samples += (int) batch.size(0);
+    }
+    if (report.samples > 0) {
+        report.value_mse = float(value_se / report.samples);
+        report.policy_kl = float(policy_kl / report.samples);
+    }
+    return report;
+}
+
+void QuantizedJackalModel::to(torch::Device device) {
+    if (!device.is_cpu()) {
+        throw std::runtime_error("the quantized model runs on CPU only");
+    }
+}
+
+GameModelOutput QuantizedJackalModel::forward(const torch::Tensor &batch) {
+    if (!calibrated) {
+        throw std::runtime_error("QuantizedJackalModel::forward called before calibrate()");
+    }
+    torch::NoGradGuard no_grad;
+    auto x = torch::quantize_per_tensor(batch.to(torch::kFloat).contiguous(), input_observer.scale(),
+                                        input_observer.zero_point(), torch::kQUInt8);
+    x = conv_quantized(conv, x, conv_observer, true);
+    for (auto &block : blocks) {
+        auto y = conv_quantized(block.conv1, x, block.hidden, true);
+        y = conv_quantized(block.conv2, y, block.branch, false);
+        x = call_op("quantized::add_relu", "", {y, x, block.output.scale(), block.output.zero_point()}).toTensor();
+    }
+    auto v = conv_quantized(value_conv, x, value_conv_observer, true);
+    v = linear_quantized(value_linear, flatten(v), value_linear_observer, true);
+    v = linear_quantized(value_output, v, value_output_observer, false).dequantize();
+    torch::Tensor policy;
+    if (action_value && policy_head_type == POLICY_HEAD_FACTORIZED) {
+        auto p = conv_quantized(policy_conv, x, policy_conv_observer, true);
+        p = flatten_planes(conv_quantized(policy_output, p, policy_output_observer, false).dequantize());
+        policy = raw_policy ? p : torch::log_softmax(p, 1);
+    } else if (action_value) {
+        auto p = conv_quantized(policy_conv, x, policy_conv_observer, true);
+        p = linear_quantized(policy_linear, flatten(p), policy_linear_observer, false).dequantize();
+        policy = raw_policy ? p : torch::log_softmax(p, 1);
+    }
+    return GameModelOutput{policy, torch::tanh(v)};
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <torch/torch.h>
+#include <ATen/core/ivalue.h>
+#include "game_model.h"
+
+
+// Per-tensor affine quint8 parameters of an activation, derived from the value range seen during calibration
+struct ActivationObserver {
+    float min{0};
+    float max{0};
+
+    void observe(const torch::Tensor &x);
+
+    double scale() const;
+
+    int64_t zero_point() const;
+};
+
+// Convolution with its BatchNorm folded in. packed holds the int8 weights prepacked for fbgemm.
+struct QuantizedConv {
+    torch::Tensor weight;
+    torch::Tensor bias;
+    int64_t padding{0};
+    c10::IValue packed;
+};
+
+struct QuantizedLinear {
+    torch::Tensor weight;
+    torch::Tensor bias;
+    c10::IValue packed;
+};
+
+struct QuantizedResBlock {
+    QuantizedConv conv1;
+    QuantizedConv conv2;
+    ActivationObserver hidden;
+    ActivationObserver branch;
+    ActivationObserver output;
+};
+
+struct QuantizationReport {
+    float value_mse{0};
+    float policy_kl{0};
+    int samples{0};
+};
+
+std::ostream &operator<<(std::ostream &os, const QuantizationReport &r);
+
+
+// Int8 post-training quantized copy of a JackalModel for CPU inference.
+// Convolutions use per-channel int8 weights, linear layers per-tensor int8 weights, activations are quint8 with
+// ranges taken from calibrate(). Residual additions run as quantized add+relu; only the value tanh and the policy
+// log_softmax are computed in fp32.
+class QuantizedJackalModel : public InferenceModel {
+    QuantizedConv conv;
+    std::vector<QuantizedResBlock> blocks;
+    QuantizedConv value_conv;
+    QuantizedLinear value_linear;
+    QuantizedLinear value_output;
+    QuantizedConv policy_conv;
+    QuantizedLinear policy_linear;
+    QuantizedConv policy_output;
+    bool action_value;
+    int policy_head_type;
+    bool calibrated{false};
+
+    ActivationObserver input_observer;
+    ActivationObserver conv_observer;
+    ActivationObserver value_conv_observer;
+    ActivationObserver value_linear_observer;
+    ActivationObserver value_output_observer;
+    ActivationObserver policy_conv_observer;
+    ActivationObserver policy_linear_observer;
+    ActivationObserver policy_output_observer;
+
+    GameModelOutput forward_float(const torch::Tensor &batch, bool observe);
+
+    void prepack();
+
+public:
+    explicit QuantizedJackalModel(JackalModel &model);
+
+    // estimates activation ranges on representative input batches and quantizes the weights
+    void calibrate(const std::vector<torch::Tensor> &batches);
+
+    // compares the quantized outputs against the fp32 model: value MSE and policy KL(fp32 || int8)
+    QuantizationReport evaluate(JackalModel &model, const std::vector<torch::Tensor> &batches);
+
+    void to(torch::Device device) override;
+
+    GameModelOutput forward(const torch::Tensor &batch) override;
+};
@@ -0,0 +1,582 @@
+#include "resnet_engine.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+namespace {
+
+    int align_channels(int channels) {
+        return (channels + ENGINE_CHANNEL_ALIGN - 1) / ENGINE_CHANNEL_ALIGN * ENGINE_CHANNEL_ALIGN;
+    }
+
+    // Activation planes of one sample: channels-last with a one pixel zero border
+    struct Activations {
+        int height;
+        int width;
+        int stride;
+        std::vector<float> data;
+
+        Activations(int height, int width, int channels) :
+                height(height), width(width), stride(align_channels(channels)),
+                data((size_t) (height + 2) * (width + 2) * stride, 0.f) {
+        }
+
+        float *pixel(int y, int x) {
+            return &data[((size_t) (y + 1) * (width + 2) + (x + 1)) * stride];
+        }
+
+        const float *pixel(int y, int x) const {
+            return &data[((size_t) (y + 1) * (width + 2) + (x + 1)) * stride];
+        }
+    };
+
+    // out = relu?(conv(in) + residual?) for the interior pixels of out
+    typedef void (*ConvKernel)(const EngineConv &c, const Activations &in, Activations &out,
+                               const Activations *residual, bool relu);
+
+    // out = relu?(in * weight + bias) for rows input rows in_stride floats apart; output rows are
+    // align_channels(out_features) floats apart, the padded tail of each is scratch
+    typedef void (*LinearKernel)(const EngineLinear &l, const float *in, int in_stride, int rows, float *out,
+                                 bool relu);
+
+    // The vectorized kernels compute a tile of several output pixels of a row, or of several samples for the linear
+    // layers, so that every weight vector loaded feeds that many FMAs. Rows are split into equal tiles of at most
+    // the number of pixels whose accumulators fit the vector registers: 4+3 pixels on a 7x7 board, 6+6 on 12x12
+    // with AVX-512.
+    const int AVX2_TILE_PIXELS = 4;
+    const int AVX512_TILE_PIXELS = 6;
+
+    // samples a linear kernel computes at once, and samples whose head activations go through the linear layers
+    // together so that the weights are read from memory once per group
+    const int LINEAR_TILE_ROWS = 4;
+    const int ENGINE_LINEAR_ROWS = 8;
+
+    // first pixel of tile t when a row of width pixels is split into tiles equal tiles
+    inline int tile_start(int width, int tiles, int t) {
+        return t * width / tiles;
+    }
+
+    void conv_scalar(const EngineConv &c, const Activations &in, Activations &out, const Activations *residual,
+                     bool relu) {
+        int co_stride = align_channels(c.out_channels);
+        int pad = c.kernel / 2;
+        for (int y = 0; y < out.height; ++y) {
+            for (int x = 0; x < out.width; ++x) {
+                float *o = out.pixel(y, x);
+                for (int co = 0; co < c.out_channels; ++co) {
+                    o[co] = c.bias[co];
+                }
+                for (int ky = 0; ky < c.kernel; ++ky) {
+                    for (int kx = 0; kx < c.kernel; ++kx) {
+                        const float *i = in.pixel(y + ky - pad, x + kx - pad);
+                        const float *w = &c.weight[(size_t) (ky * c.kernel + kx) * c.in_channels * co_stride];
+                        for (int ci = 0; ci < c.in_channels; ++ci, w += co_stride) {
+                            for (int co = 0; co < c.out_channels; ++co) {
+                                o[co] += i[ci] * w[co];
+                            }
+                        }
+                    }
+                }
+                if (residual) {
+                    const float *r = residual->pixel(y, x);
+                    for (int co = 0; co < c.out_channels; ++co) {
+                        o[co] += r[co];
+                    }
+                }
+                if (relu) {
+                    for (int co = 0; co < c.out_channels; ++co) {
+                        o[co] = std::max(o[co], 0.f);
+                    }
+                }
+            }
+        }
+    }
+
+    void linear_scalar(const EngineLinear &l, const float *in, int in_stride, int rows, float *out, bool relu) {
+        int out_stride = align_channels(l.out_features);
+        for (int n = 0; n < rows; ++n, in += in_stride, out += out_stride) {
+            std::copy(l.bias.begin(), l.bias.begin() + l.out_features, out);
+            for (int i = 0; i < l.in_features; ++i) {
+                const float *w = &l.weight[(size_t) i * out_stride];
+                for (int o = 0; o < l.out_features; ++o) {
+                    out[o] += in[i] * w[o];
+                }
+            }
+            if (relu) {
+                for (int o = 0; o < l.out_features; ++o) {
+                    out[o] = std::max(out[o], 0.f);
+                }
+            }
+        }
+    }
+
+    // Computes BLOCKS x 8 output channels starting at co for PIXELS pixels of row y starting at x, keeping the
+    // accumulators in registers
+    template<int PIXELS, int BLOCKS>
+    __attribute__((target("avx2,fma")))
+    inline void conv_tile_avx2(const EngineConv &c, const Activations &in, Activations &out,
+                               const Activations *residual, bool relu, int y, int x, int co) {
+        int co_stride = align_channels(c.out_channels);
+        __m256 acc[PIXELS][BLOCKS];
+        for (int b = 0; b < BLOCKS; ++b) {
+            __m256 bias = _mm256_loadu_ps(&c.bias[co + b * 8]);
+            for (int p = 0; p < PIXELS; ++p) {
+                acc[p][b] = bias;
+            }
+        }
+        int pad = c.kernel / 2;
+        for (int ky = 0; ky < c.kernel; ++ky) {
+            for (int kx = 0; kx < c.kernel; ++kx) {
+                const float *i = in.pixel(y + ky - pad, x + kx - pad);
+                const float *w = &c.weight[(size_t) (ky * c.kernel + kx) * c.in_channels * co_stride + co];
+                for (int ci = 0; ci < c.in_channels; ++ci, w += co_stride) {
+                    __m256 wv[BLOCKS];
+                    for (int b = 0; b < BLOCKS; ++b) {
+                        wv[b] = _mm256_loadu_ps(w + b * 8);
+                    }
+                    for (int p = 0; p < PIXELS; ++p) {
+                        __m256 v = _mm256_broadcast_ss(i + p * in.stride + ci);
+                        for (int b = 0; b < BLOCKS; ++b) {
+                            acc[p][b] = _mm256_fmadd_ps(v, wv[b], acc[p][b]);
+                        }
+                    }
+                }
+            }
+        }
+        for (int p = 0; p < PIXELS; ++p) {
+            float *o = out.pixel(y, x + p) + co;
+            const float *r = residual ? residual->pixel(y, x + p) + co : nullptr;
+            for (int b = 0; b < BLOCKS; ++b) {
+                if (r) {
+                    acc[p][b] = _mm256_add_ps(acc[p][b], _mm256_loadu_ps(r + b * 8));
+                }
+                if (relu) {
+                    acc[p][b] = _mm256_max_ps(acc[p][b], _mm256_setzero_ps());
+                }
+                _mm256_storeu_ps(o + b * 8, acc[p][b]);
+            }
+        }
+    }
+
+    template<int PIXELS>
+    __attribute__((target("avx2,fma")))
+    void conv_pixels_avx2(const EngineConv &c, const Activations &in, Activations &out, const Activations *residual,
+                          bool relu, int y, int x) {
+        int co_stride = align_channels(c.out_channels);
+        int co = 0;
+        for (; co + 16 <= co_stride; co += 16) {
+            conv_tile_avx2<PIXELS, 2>(c, in, out, residual, relu, y, x, co);
+        }
+        for (; co < co_stride; co += 8) {
+            conv_tile_avx2<PIXELS, 1>(c, in, out, residual, relu, y, x, co);
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    void conv_avx2(const EngineConv &c, const Activations &in, Activations &out, const Activations *residual,
+                   bool relu) {
+        int tiles = (out.width + AVX2_TILE_PIXELS - 1) / AVX2_TILE_PIXELS;
+        for (int y = 0; y < out.height; ++y) {
+            for (int t = 0; t < tiles; ++t) {
+                int x = tile_start(out.width, tiles, t);
+                switch (tile_start(out.width, tiles, t + 1) - x) {
+                    case 4:
+                        conv_pixels_avx2<4>(c, in, out, residual, relu, y, x);
+                        break;
+                    case 3:
+                        conv_pixels_avx2<3>(c, in, out, residual, relu, y, x);
+                        break;
+                    case 2:
+                        conv_pixels_avx2<2>(c, in, out, residual, relu, y, x);
+                        break;
+                    default:
+                        conv_pixels_avx2<1>(c, in, out, residual, relu, y, x);
+                }
+            }
+        }
+    }
+
+    // BLOCKS x 8 outputs starting at o for ROWS samples
+    template<int ROWS, int BLOCKS>
+    __attribute__((target("avx2,fma")))
+    inline void linear_tile_avx2(const EngineLinear &l, const float *in, int in_stride, float *out, int o,
+                                 bool relu) {
+        int out_stride = align_channels(l.out_features);
+        __m256 acc[ROWS][BLOCKS];
+        for (int b = 0; b < BLOCKS; ++b) {
+            __m256 bias = _mm256_loadu_ps(&l.bias[o + b * 8]);
+            for (int n = 0; n < ROWS; ++n) {
+                acc[n][b] = bias;
+            }
+        }
+        const float *w = &l.weight[o];
+        for (int i = 0; i < l.in_features; ++i, w += out_stride) {
+            __m256 wv[BLOCKS];
+            for (int b = 0; b < BLOCKS; ++b) {
+                wv[b] = _mm256_loadu_ps(w + b * 8);
+            }
+            for (int n = 0; n < ROWS; ++n) {
+                __m256 v = _mm256_broadcast_ss(in + n * in_stride + i);
+                for (int b = 0; b < BLOCKS; ++b) {
+                    acc[n][b] = _mm256_fmadd_ps(v, wv[b], acc[n][b]);
+                }
+            }
+        }
+        for (int n = 0; n < ROWS; ++n) {
+            for (int b = 0; b < BLOCKS; ++b) {
+                if (relu) {
+                    acc[n][b] = _mm256_max_ps(acc[n][b], _mm256_setzero_ps());
+                }
+                _mm256_storeu_ps(out + n * out_stride + o + b * 8, acc[n][b]);
+            }
+        }
+    }
+
+    template<int ROWS>
+    __attribute__((target("avx2,fma")))
+    void linear_rows_avx2(const EngineLinear &l, const float *in, int in_stride, float *out, bool relu) {
+        int out_stride = align_channels(l.out_features);
+        int o = 0;
+        for (; o + 16 <= out_stride; o += 16) {
+            linear_tile_avx2<ROWS, 2>(l, in, in_stride, out, o, relu);
+        }
+        for (; o < out_stride; o += 8) {
+            linear_tile_avx2<ROWS, 1>(l, in, in_stride, out, o, relu);
+        }
+    }
+
+    __attribute__((target("avx2,fma")))
+    void linear_avx2(const EngineLinear &l, const float *in, int in_stride, int rows, float *out, bool relu) {
+        int out_stride = align_channels(l.out_features);
+        int n = 0;
+        for (; n + LINEAR_TILE_ROWS <= rows; n += LINEAR_TILE_ROWS) {
+            linear_rows_avx2<LINEAR_TILE_ROWS>(l, in + n * in_stride, in_stride, out + n * out_stride, relu);
+        }
+        for (; n < rows; ++n) {
+            linear_rows_avx2<1>(l, in + n * in_stride, in_stride, out + n * out_stride, relu);
+        }
+    }
+
+    template<int PIXELS, int BLOCKS>
+    __attribute__((target("avx512f")))
+    inline void conv_tile_avx512(const EngineConv &c, const Activations &in, Activations &out,
+                                 const Activations *residual, bool relu, int y, int x, int co) {
+        int co_stride = align_channels(c.out_channels);
+        __m512 acc[PIXELS][BLOCKS];
+        for (int b = 0; b < BLOCKS; ++b) {
+            __m512 bias = _mm512_loadu_ps(&c.bias[co + b * 16]);
+            for (int p = 0; p < PIXELS; ++p) {
+                acc[p][b] = bias;
+            }
+        }
+        int pad = c.kernel / 2;
+        for (int ky = 0; ky < c.kernel; ++ky) {
+            for (int kx = 0; kx < c.kernel; ++kx) {
+                const float *i = in.pixel(y + ky - pad, x + kx - pad);
+                const float *w = &c.weight[(size_t) (ky * c.kernel + kx) * c.in_channels * co_stride + co];
+                for (int ci = 0; ci < c.in_channels; ++ci, w += co_stride) {
+                    __m512 wv[BLOCKS];
+                    for (int b = 0; b < BLOCKS; ++b) {
+                        wv[b] = _mm512_loadu_ps(w + b * 16);
+                    }
+                    for (int p = 0; p < PIXELS; ++p) {
+                        __m512 v = _mm512_set1_ps(i[p * in.stride + ci]);
+                        for (int b = 0; b < BLOCKS; ++b) {
+                            acc[p][b] = _mm512_fmadd_ps(v, wv[b], acc[p][b]);
+                        }
+                    }
+                }
+            }
+        }
+        for (int p = 0; p < PIXELS; ++p) {
+            float *o = out.pixel(y, x + p) + co;
+            const float *r = residual ? residual->pixel(y, x + p) + co : nullptr;
+            for (int b = 0; b < BLOCKS; ++b) {
+                if (r) {
+                    acc[p][b] = _mm512_add_ps(acc[p][b], _mm512_loadu_ps(r + b * 16));
+                }
+                if (relu) {
+                    acc[p][b] = _mm512_max_ps(acc[p][b], _mm512_setzero_ps());
+                }
+                _mm512_storeu_ps(o + b * 16, acc[p][b]);
+            }
+        }
+    }
+
+    template<int PIXELS>
+    __attribute__((target("avx512f")))
+    void conv_pixels_avx512(const EngineConv &c, const Activations &in, Activations &out,
+                            const Activations *residual, bool relu, int y, int x) {
+        int co_stride = align_channels(c.out_channels);
+        int co = 0;
+        for (; co + 64 <= co_stride; co += 64) {
+            conv_tile_avx512<PIXELS, 4>(c, in, out, residual, relu, y, x, co);
+        }
+        for (; co < co_stride; co += 16) {
+            conv_tile_avx512<PIXELS, 1>(c, in, out, residual, relu, y, x, co);
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    void conv_avx512(const EngineConv &c, const Activations &in, Activations &out, const Activations *residual,
+                     bool relu) {
+        int tiles = (out.width + AVX512_TILE_PIXELS - 1) / AVX512_TILE_PIXELS;
+        for (int y = 0; y < out.height; ++y) {
+            for (int t = 0; t < tiles; ++t) {
+                int x = tile_start(out.width, tiles, t);
+                switch (tile_start(out.width, tiles, t + 1) - x) {
+                    case 6:
+                        conv_pixels_avx512<6>(c, in, out, residual, relu, y, x);
+                        break;
+                    case 5:
+                        conv_pixels_avx512<5>(c, in, out, residual, relu, y, x);
+                        break;
+                    case 4:
+                        conv_pixels_avx512<4>(c, in, out, residual, relu, y, x);
+                        break;
+                    case 3:
+                        conv_pixels_avx512<3>(c, in, out, residual, relu, y, x);
+                        break;
+                    case 2:
+                        conv_pixels_avx512<2>(c, in, out, residual, relu, y, x);
+                        break;
+                    default:
+                        conv_pixels_avx512<1>(c, in, out, residual, relu, y, x);
+                }
+            }
+        }
+    }
+
+    template<int ROWS, int BLOCKS>
+    __attribute__((target("avx512f")))
+    inline void linear_tile_avx512(const EngineLinear &l, const float *in, int in_stride, float *out, int o,
+                                   bool relu) {
+        int out_stride = align_channels(l.out_features);
+        __m512 acc[ROWS][BLOCKS];
+        for (int b = 0; b < BLOCKS; ++b) {
+            __m512 bias = _mm512_loadu_ps(&l.bias[o + b * 16]);
+            for (int n = 0; n < ROWS; ++n) {
+                acc[n][b] = bias;
+            }
+        }
+        const float *w = &l.weight[o];
+        for (int i = 0; i < l.in_features; ++i, w += out_stride) {
+            __m512 wv[BLOCKS];
+            for (int b = 0; b < BLOCKS; ++b) {
+                wv[b] = _mm512_loadu_ps(w + b * 16);
+            }
+            for (int n = 0; n < ROWS; ++n) {
+                __m512 v = _mm512_set1_ps(in[n * in_stride + i]);
+                for (int b = 0; b < BLOCKS; ++b) {
+                    acc[n][b] = _mm512_fmadd_ps(v, wv[b], acc[n][b]);
+                }
+            }
+        }
+        for (int n = 0; n < ROWS; ++n) {
+            for (int b = 0; b < BLOCKS; ++b) {
+                if (relu) {
+                    acc[n][b] = _mm512_max_ps(acc[n][b], _mm512_setzero_ps());
+                }
+                _mm512_storeu_ps(out + n * out_stride + o + b * 16, acc[n][b]);
+            }
+        }
+    }
+
+    template<int ROWS>
+    __attribute__((target("avx512f")))
+    void linear_rows_avx512(const EngineLinear &l, const float *in, int in_stride, float *out, bool relu) {
+        int out_stride = align_channels(l.out_features);
+        int o = 0;
+        for (; o + 64 <= out_stride; o += 64) {
+            linear_tile_avx512<ROWS, 4>(l, in, in_stride, out, o, relu);
+        }
+        for (; o < out_stride; o += 16) {
+            linear_tile_avx512<ROWS, 1>(l, in, in_stride, out, o, relu);
+        }
+    }
+
+    __attribute__((target("avx512f")))
+    void linear_avx512(const EngineLinear &l, const float *in, int in_stride, int rows, float *out, bool relu) {
+        int out_stride = align_channels(l.out_features);
+        int n = 0;
+        for (; n + LINEAR_TILE_ROWS <= rows; n += LINEAR_TILE_ROWS) {
+            linear_rows_avx512<LINEAR_TILE_ROWS>(l, in + n * in_stride, in_stride, out + n * out_stride, relu);
+        }
+        for (; n < rows; ++n) {
+            linear_rows_avx512<1>(l, in + n * in_stride, in_stride, out + n * out_stride, relu);
+        }
+    }
+
+    struct Kernels {
+        const char *name;
+        ConvKernel conv;
+        LinearKernel linear;
+    };
+
+    const Kernels &select_kernels() {
+        static const Kernels kernels = []() {
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f")) {
+                return Kernels{"avx512", conv_avx512, linear_avx512};
+            }
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+                return Kernels{"avx2", conv_avx2, linear_avx2};
+            }
+            return Kernels{"scalar", conv_scalar, linear_scalar};
+        }();
+        return kernels;
+    }
+
+    // flattens the interior of a channels-last activation in the NCHW order torch::reshape produces
+    void flatten(const Activations &a, int channels, float *out) {
+        for (int c = 0; c < channels; ++c) {
+            for (int y = 0; y < a.height; ++y) {
+                for (int x = 0; x < a.width; ++x) {
+                    *out++ = a.pixel(y, x)[c];
+                }
+            }
+        }
+    }
+}
+
+EngineConv::EngineConv(const float *torch_weight, const float *torch_bias, int in_channels, int out_channels,
+                       int kernel) :
+        in_channels(in_channels), out_channels(out_channels), kernel(kernel) {
+    int co_stride = align_channels(out_channels);
+    weight.assign((size_t) kernel * kernel * in_channels * co_stride, 0.f);
+    bias.assign(co_stride, 0.f);
+    for (int co = 0; co < out_channels; ++co) {
+        bias[co] = torch_bias[co];
+        for (int ci = 0; ci < in_channels; ++ci) {
+            for (int ky = 0; ky < kernel; ++ky) {
+                for (int kx = 0; kx < kernel; ++kx) {
+                    weight[((size_t) (ky * kernel + kx) * in_channels + ci) * co_stride + co] =
+                            torch_weight[((co * in_channels + ci) * kernel + ky) * kernel + kx];
+                }
+            }
+        }
+    }
+}
+
+EngineLinear::EngineLinear(const float *torch_weight, const float *torch_bias, int in_features, int out_features) :
+        in_features(in_features), out_features(out_features) {
+    int out_stride = align_channels(out_features);
+    weight.assign((size_t) in_features * out_stride, 0.f);
+    bias.assign(out_stride, 0.f);
+    for (int o = 0; o < out_features; ++o) {
+        bias[o] = torch_bias[o];
+        for (int i = 0; i < in_features; ++i) {
+            weight[(size_t) i * out_stride + o] = torch_weight[(size_t) o * in_features + i];
+        }
+    }
+}
+
+ResNetEngine::ResNetEngine(int height, int width, int input_channels, int players, bool action_value) :
+        height(height), width(width), input_channels(input_channels), players(players), action_value(action_value) {
+}
+
+int ResNetEngine::policy_size() const {
+    if (!action_value) {
+        return 0;
+    }
+    return policy_output.out_channels > 0 ? height * width * policy_output.out_channels : policy_linear.out_features;
+}
+
+const char *ResNetEngine::kernels() {
+    return select_kernels().name;
+}
+
+void ResNetEngine::forward(const float *input, int batch, float *value, float *policy, bool log_softmax) const {
+    const auto &k = select_kernels();
+    int channels = conv.out_channels;
+    Activations in(height, width, input_channels);
+    Activations x(height, width, channels);
+    Activations hidden(height, width, channels);
+    Activations next(height, width, channels);
+    Activations head(height, width, std::max(value_conv.out_channels, policy_conv.out_channels));
+    Activations policy_planes(height, width, policy_output.out_channels);
+    bool factorized = policy_output.out_channels > 0;
+    int size = policy_size();
+    int policy_stride = align_channels(size);
+    // the linear layers take ENGINE_LINEAR_ROWS samples at a time, so their weights are read once per group
+    std::vector<float> value_flat((size_t) ENGINE_LINEAR_ROWS * value_linear.in_features);
+    std::vector<float> value_hidden((size_t) ENGINE_LINEAR_ROWS * align_channels(value_linear.out_features));
+    std::vector<float> value_out((size_t) ENGINE_LINEAR_ROWS * align_channels(value_output.out_features));
+    std::vector<float> policy_flat(action_value && !factorized ?
+                                   (size_t) ENGINE_LINEAR_ROWS * policy_linear.in_features : 0);
+    std::vector<float> policy_out(action_value ? (size_t) ENGINE_LINEAR_ROWS * policy_stride : 0);
+    int plane = height * width;
+    for (int first = 0; first < batch; first += ENGINE_LINEAR_ROWS) {
+        int rows = std::min(ENGINE_LINEAR_ROWS, batch - first);
+        for (int r = 0; r < rows; ++r) {
+            const float *sample = input + (size_t) (first + r) * input_channels * plane;
+            for (int c = 0; c < input_channels; ++c) {
+                for (int y = 0; y < height; ++y) {
+                    for (int px = 0; px < width; ++px) {
+                        in.pixel(y, px)[c] = sample[c * plane + y * width + px];
+                    }
+                }
+            }
+            k.conv(conv, in, x, nullptr, true);
+            for (auto &block : blocks) {
+                k.conv(block.first, x, hidden, nullptr, true);
+                k.conv(block.second, hidden, next, &x, true);
+                std::swap(x.data, next.data);
+            }
+
+            k.conv(value_conv, x, head, nullptr, true);
+            flatten(head, value_conv.out_channels, &value_flat[(size_t) r * value_linear.in_features]);
+            if (!action_value) {
+                continue;
+            }
+            k.conv(policy_conv, x, head, nullptr, true);
+            if (factorized) {
+                // channels-last planes are already in action code order: from-square, then offset and with_items
+                k.conv(policy_output, head, policy_planes, nullptr, false);
+                float *out = &policy_out[(size_t) r * policy_stride];
+                for (int y = 0; y < height; ++y) {
+                    for (int px = 0; px < width; ++px) {
+                        out = std::copy_n(policy_planes.pixel(y, px), policy_output.out_channels, out);
+                    }
+                }
+            } else {
+                flatten(head, policy_conv.out_channels, &policy_flat[(size_t) r * policy_linear.in_features]);
+            }
+        }
+
+        k.linear(value_linear, &value_flat[0], value_linear.in_features, rows, &value_hidden[0], true);
+        k.linear(value_output, &value_hidden[0], align_channels(value_linear.out_features), rows, &value_out[0],
+                 false);
+        for (int r = 0; r < rows; ++r) {
+            for (int p = 0; p < players; ++p) {
+                value[(size_t) (first + r) * players + p] =
+                        std::tanh(value_out[(size_t) r * align_channels(value_output.out_features) + p]);
+            }
+        }
+        if (!action_value) {
+            continue;
+        }
+        if (!factorized) {
+            k.linear(policy_linear, &policy_flat[0], policy_linear.in_features, rows, &policy_out[0], false);
+        }
+        for (int r = 0; r < rows; ++r) {
+            const float *logits = &policy_out[(size_t) r * policy_stride];
+            float *p = policy + (size_t) (first + r) * size;
+            if (!log_softmax) {
+                std::copy_n(logits, size, p);
+                continue;
+            }
+            float max = *std::max_element(logits, logits + size);
+            double sum = 0;
+            for (int i = 0; i < size; ++i) {
+                sum += std::exp(logits[i] - max);
+            }
+            float log_sum = max + (float) std::log(sum);
+            for (int i = 0; i < size; ++i) {
+                p[i] = logits[i] - log_sum;
+            }
+        }
+    }
+}
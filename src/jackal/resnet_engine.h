@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+
+
+// Weights of a convolution with BatchNorm already folded in, stored as [ky][kx][in_channel][out_channel] with the
+// output channels padded to a multiple of ENGINE_CHANNEL_ALIGN so that kernels never need a scalar tail.
+struct EngineConv {
+    int in_channels{0};
+    int out_channels{0};
+    int kernel{1};
+    std::vector<float> weight;
+    std::vector<float> bias;
+
+    EngineConv() = default;
+
+    // torch_weight is [out][in][kernel][kernel] as stored by torch::nn::Conv2d
+    EngineConv(const float *torch_weight, const float *torch_bias, int in_channels, int out_channels, int kernel);
+};
+
+// Weights of a linear layer stored as [in][out] with the outputs padded to ENGINE_CHANNEL_ALIGN
+struct EngineLinear {
+    int in_features{0};
+    int out_features{0};
+    std::vector<float> weight;
+    std::vector<float> bias;
+
+    EngineLinear() = default;
+
+    // torch_weight is [out][in] as stored by torch::nn::Linear
+    EngineLinear(const float *torch_weight, const float *torch_bias, int in_features, int out_features);
+};
+
+const int ENGINE_CHANNEL_ALIGN = 16;
+
+
+// Inference engine for the exact JackalModel topology on small boards: a 3x3 conv stem, residual blocks of two 3x3
+// convolutions, a value head and an optional policy head. Activations are kept per sample in channels-last layout
+// with a zero border, so the 3x3 kernels run without bounds checks and vectorize over output channels. The
+// convolutions compute tiles of several pixels of a row and the linear layers groups of samples, so every weight
+// loaded is reused from registers.
+// A non-empty policy_output selects the factorized policy head in place of policy_linear.
+// AVX-512 and AVX2 kernels are selected at runtime, with a scalar fallback.
+class ResNetEngine {
+public:
+    int height;
+    int width;
+    int input_channels;
+    int players;
+    bool action_value;
+
+    EngineConv conv;
+    std::vector<std::pair<EngineConv, EngineConv>> blocks;
+    EngineConv value_conv;
+    EngineLinear value_linear;
+    EngineLinear value_output;
+    EngineConv policy_conv;
+    EngineLinear policy_linear;
+    EngineConv policy_output;
+
+    ResNetEngine(int height, int width, int input_channels, int players, bool action_value);
+
+    int policy_size() const;
+
+    // input is NCHW [batch][input_channels][height][width]; writes value [batch][players] (tanh applied) and, when
+    // the policy head is enabled, policy [batch][policy_size()] as log-probabilities, or as raw logits when
+    // log_softmax is false
+    void forward(const float *input, int batch, float *value, float *policy, bool log_softmax = true) const;
+
+    // name of the kernel set picked for this CPU
+    static const char *kernels();
+};
@@ -0,0 +1,55 @@
+#include "jackal/jackal.h"
+#include "jackal/game_model.h"
+#include "jackal/frozen_model.h"
+#include "jackal/engine_model.h"
+
+#include <chrono>
+#include <torch/torch.h>
+
+using namespace std;
+
+// Compares evaluations per second of the libtorch JackalModel, the frozen model and the ResNetEngine on CPU.
+// usage: jackal_engine_perftest [size] [channels] [blocks] [batch] [policy_head]
+
+double evals_per_second(InferenceModel &model, const torch::Tensor &batch, int iterations) {
+    model.forward(batch);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        model.forward(batch);
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    return batch.size(0) * iterations / elapsed.count();
+}
+
+int main(int argc, char *argv[]) {
+    int size = argc > 1 ? atoi(argv[1]) : 7;
+    int channels = argc > 2 ? atoi(argv[2]) : 64;
+    int blocks = argc > 3 ? atoi(argv[3]) : 5;
+    int batch_size = argc > 4 ? atoi(argv[4]) : 256;
+    int policy_head = argc > 5 ? atoi(argv[5]) : POLICY_HEAD_DENSE;
+    int iterations = 20;
+    torch::NoGradGuard no_grad;
+
+    Jackal game(size, size, 2);
+    JackalModel model(game.get_state().sizes(), channels, blocks, 2, true, policy_head);
+    model->eval();
+    vector<torch::Tensor> states;
+    while (states.size() < batch_size) {
+        if (game.get_possible_actions().empty()) {
+            game = Jackal(size, size, 2);
+        }
+        states.push_back(game.get_state());
+        game = game.take_action(game.get_random_action());
+    }
+    auto batch = torch::cat(states);
+
+    TorchInferenceModel<JackalModel> torch_model(model);
+    FrozenJackalModel frozen_model(model);
+    EngineJackalModel engine_model(model);
+    cout << "board " << size << "x" << size << ", " << channels << " channels, " << blocks << " blocks, batch "
+         << batch_size << ", policy head " << policy_head << ", " << torch::get_num_threads() << " threads, engine kernels "
+         << ResNetEngine::kernels() << endl;
+    cout << "torch:  " << evals_per_second(torch_model, batch, iterations) << " evals/s" << endl;
+    cout << "frozen: " << evals_per_second(frozen_model, batch, iterations) << " evals/s" << endl;
+    cout << "engine: " << evals_per_second(engine_model, batch, iterations) << " evals/s" << endl;
+}
@@ -0,0 +1,101 @@
+#include "rl/shared_inference.h"
+
+#include "jackal/jackal_train.h"
+#include <nlohmann/json.hpp>
+
+using namespace std;
+
+using json = nlohmann::json;
+
+
+// Serves the model in dir to jackal_self_play processes started with "inference_shared_memory": 1 on the same dir,
+// until SIGINT/SIGTERM. With simulation_model_reload set, new checkpoints written by jackal_train are swapped in.
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        cerr << "jackal_inference_server dir [--config json] [--config_file json_file]" << endl;
+        exit(-1);
+    }
+    unordered_map<string, float> config;
+    int argi = 1;
+    string dir = argv[argi++];
+    if (!strcmp(argv[argi], "--config")) {
+        config = load_config_from_string(argv[argi + 1]);
+    } else if (!strcmp(argv[argi], "--config_file")) {
+        config = load_config_from_file(argv[argi + 1]);
+    }
+    int width = (int) config["jackal_width"];
+    int height = (int) config["jackal_height"];
+    int players = (int) config["jackal_players"];
+    Jackal jackal(height, width, players);
+    auto dims = jackal.get_state().sizes();
+    JackalModel model(dims,
+                      int(config["jackal_channels"]),
+                      int(config["jackal_blocks"]),
+                      players,
+                      config["enable_action_value"] > 0,
+                      int(config["policy_head"]));
+    auto model_path = dir + "/model.bin";
+    if (experimental::filesystem::exists(model_path)) {
+        cout << "Loading model from " << model_path << endl;
+        torch::load(model, model_path);
+    } else {
+        throw std::runtime_error("no model.bin found");
+    }
+
+    // the slots are sized for the replies of this model, so the bridge never has to truncate one
+    int value_size, policy_size;
+    {
+        torch::NoGradGuard no_grad;
+        model->eval();
+        auto output = model(jackal.get_state().to(torch::kFloat));
+        value_size = (int) output.value.size(1);
+        policy_size = output.policy.defined() && output.policy.numel() > 0 ? (int) output.policy.size(1) : 0;
+    }
+    if (value_size != players) {
+        throw std::runtime_error("model predicts " + to_string(value_size) + " values for " + to_string(players) +
+                                 " players");
+    }
+
+    TModelQueue model_queue(INFERENCE_PRIORITY_LEVELS);
+    auto inference_server = make_inference_server(dir, width, height, players, model, config, model_queue);
+    auto region = SharedInferenceRegion::create(shared_inference_name(dir), int(config["inference_shared_slots"]),
+                                                dims, value_size, policy_size);
+    SharedInferenceBridge bridge(*region, model_queue);
+
+    std::atomic<bool> server_terminated(false);
+    std::atomic<bool> bridge_terminated(false);
+    std::thread model_thread(&InferenceServer::run, inference_server.get(), &server_terminated);
+    std::thread bridge_thread(&SharedInferenceBridge::run, &bridge, &bridge_terminated);
+    cout << "Serving " << dir << " at shared memory " << region->get_name() << " with "
+         << int(config["inference_shared_slots"]) << " slots" << endl;
+
+    std::unique_ptr<ModelReloader> reloader;
+    if (config["simulation_model_reload"] > 0) {
+        reloader.reset(new ModelReloader(dir, width, height, players, model, config));
+    }
+    auto logger = gen_logger();
+    InferenceStatsReporter stats_reporter(inference_server->stats, &logger, dir + "/inference_stats.txt");
+    self_play_interrupted = false;
+    std::signal(SIGINT, self_play_interrupt_handler);
+    std::signal(SIGTERM, self_play_interrupt_handler);
+    long prev_requests = 0;
+    while (!self_play_interrupted) {
+        sleep(1);
+        long total_requests = inference_server->stats.requests;
+        cout << "Total requests served: " << total_requests << ". Requests per second: "
+             << (total_requests - prev_requests) << ". Mean batch size: " << inference_server->stats.mean_batch_size()
+             << endl;
+        prev_requests = total_requests;
+        stats_reporter.report();
+        if (reloader && reloader->poll(*inference_server)) {
+            // lets the workers drop the cached evaluations of the previous model
+            region->header().model_version = inference_server->model_version.load();
+        }
+    }
+    // the bridge answers the requests it has queued, so the server goes last
+    bridge_terminated = true;
+    bridge_thread.join();
+    server_terminated = true;
+    model_thread.join();
+    print_inference_summary(dir, &inference_server->stats, nullptr);
+}
@@ -44,15 +44,19 @@ int main(int argc, char *argv[]) {
         config = load_config_from_file(argv[argi + 1]);
     }
 
+    auto device = get_device(config);
     for (int col = 1; col < 7 - 1; col++) {
         auto jackal = gen_state(config, col);
         JackalModel model(jackal.get_state().sizes(),
                           int(config["jackal_channels"]),
                           int(config["jackal_blocks"]),
                           int(config["jackal_players"]),
-                          config["enable_action_value"] > 0);
+                          config["enable_action_value"] > 0,
+                          int(config["policy_head"]));
         torch::load(model, model_path);
-        GameModelOutput out = model(jackal.get_state().to(torch::kCUDA));
+        model->eval();
+        model->to(device);
+        GameModelOutput out = model(jackal.get_state().to(device));
         auto sav = to_state_action_value(out, jackal);
         cv::imwrite("tmp/jackal_model_test/col" + to_string(col) + ".png",
                     jackal.get_image(&sav));
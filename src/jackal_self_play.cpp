@@ -30,7 +30,8 @@ int main(int argc, char *argv[]) {
                       int(config["jackal_channels"]),
                       int(config["jackal_blocks"]),
                       int(config["jackal_players"]),
-                      config["enable_action_value"] > 0);
+                      config["enable_action_value"] > 0,
+                      int(config["policy_head"]));
     auto model_path = dir + "/model.bin";
     if (experimental::filesystem::exists(model_path)) {
         cout << "Loading model from " << model_path << endl;
@@ -50,10 +51,19 @@ int main(int argc, char *argv[]) {
     for (auto &kv: config) {
         std::cout << "  " << kv.first << ": \t" << kv.second << std::endl;
     }
-    multithreaded_self_plays(
-            dir,
-            (int) config["jackal_width"], (int) config["jackal_height"],
-            model,
-            config,
-            (int) config["jackal_players"]);
+    if (config["simulation_streaming"] > 0) {
+        streaming_self_plays(
+                dir,
+                (int) config["jackal_width"], (int) config["jackal_height"],
+                model,
+                config,
+                (int) config["jackal_players"]);
+    } else {
+        multithreaded_self_plays(
+                dir,
+                (int) config["jackal_width"], (int) config["jackal_height"],
+                model,
+                config,
+                (int) config["jackal_players"]);
+    }
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "../third_party/queue/concurrentqueue.h"
 #include "../third_party/queue/lightweightsemaphore.h"
 #include "jackal/game_model.h"
+#include "util/utils.h"
 
 #include <torch/torch.h>
 #include <opencv2/opencv.hpp>
@@ -64,7 +65,7 @@ void reply(RequestContext &request) {
     }
 }
 
-bool read_request(TModelQueue &queue, RequestContext &request) {
+bool read_request(TModelQueue &queue, RequestContext &request, torch::Device device) {
     auto &items = request.items;
     bool terminate = false;
     items.clear();
@@ -82,19 +83,19 @@ bool read_request(TModelQueue &queue, RequestContext &request) {
     for (auto &i : items) {
         states.push_back(*i.state);
     }
-    request.batch = torch::stack({&states[0], states.size()}).to(torch::kCUDA);
+    request.batch = torch::stack({&states[0], states.size()}).to(device);
     return terminate;
 }
 
 
-void model_loop(GameModel &model, TModelQueue &queue) {
+void model_loop(GameModel &model, TModelQueue &queue, torch::Device device) {
     time_t tm;
     time(&tm);
     int total_states = 0;
     RequestContext cur_request;
     bool terminate = false;
     while (!terminate) {
-        terminate = read_request(queue, cur_request);
+        terminate = read_request(queue, cur_request, device);
         total_states += cur_request.items.size();
         cur_request.model_output = model.forward(cur_request.batch);
         reply(cur_request);
@@ -103,7 +104,17 @@ void model_loop(GameModel &model, TModelQueue &queue) {
 }
 
 
-int main() {
+// usage: jackal_self_play_perftest [--config json] [--config_file json_file]; device_cuda and policy_head are read
+// from the config
+int main(int argc, char *argv[]) {
+    unordered_map<string, float> config;
+    if (argc > 2 && !strcmp(argv[1], "--config")) {
+        config = load_config_from_string(argv[2]);
+    } else if (argc > 2 && !strcmp(argv[1], "--config_file")) {
+        config = load_config_from_file(argv[2]);
+    }
+    auto device = get_device(config);
+    auto policy_head = config.find("policy_head");
     TModelQueue queue;
     std::vector<std::thread> self_play_threads;
     for (int i = 0; i < NUM_THREADS; ++i) {
@@ -112,8 +123,9 @@ int main() {
     Jackal jackal(HEIGHT, WIDTH, PLAYERS);
     auto state = jackal.get_state();
     torch::NoGradGuard no_grad;
-    JackalModel model(state.sizes(), 128, 10, 2);
-    model->to(torch::kCUDA);
+    JackalModel model(state.sizes(), 128, 10, 2, true,
+                      policy_head == config.end() ? POLICY_HEAD_DENSE : int(policy_head->second));
+    model->to(device);
     model->eval();
-    model_loop(*model, queue);
-}
\ No newline at end of file
+    model_loop(*model, queue, device);
+}
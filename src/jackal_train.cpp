@@ -30,7 +30,7 @@ int main(int argc, char *argv[]) {
     int step = 0;
 
 
-    Trainer<Jackal, JackalModel> trainer(config, torch::kCUDA);
+    Trainer<Jackal, JackalModel> trainer(config, get_device(config));
 
     auto loss = trainer.train(dir, nullptr, step,
                               int(config["jackal_channels"]),
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <torch/torch.h>
+#include "model.h"
+#include "../util/blocking_queue.h"
+#include "../util/lru_cache.h"
+#include "../mcts/mcts.h"
+#include "../util/completion_flag.h"
+#include "../util/fiber.h"
+#include "inference_stats.h"
+
+// Caller-owned buffers the inference server writes one result into. The vectors are resized by the server on first
+// use and then reused, so a search thread that keeps one InferenceReply does no allocations per evaluation.
+struct InferenceReply {
+    std::vector<float> value;
+    // policy row over the whole action space, logits or log-probabilities, valid when has_policy is set
+    std::vector<float> policy;
+    bool has_policy{false};
+    // version of the model that produced the result, see InferenceServer::swap_models
+    int model_version{0};
+    CompletionFlag done;
+    // When set, a finished reply is pushed here instead of signalling done, so that a consumer with many requests in
+    // flight picks them up in the order they complete. tag tells the consumer which request it was.
+    BlockingQueue<InferenceReply *> *completions{nullptr};
+    int tag{0};
+
+    // called by the server once the result is written; the reply may be reused as soon as this starts
+    void complete() {
+        if (completions) {
+            completions->enqueue(this);
+        } else {
+            done.signal();
+        }
+    }
+};
+
+struct TModelJob {
+    torch::Tensor *state{nullptr};
+    InferenceReply *reply{nullptr};
+    // inference_clock_us() at enqueue, for the latency statistics
+    int64_t enqueued_us{0};
+};
+
+// Request priorities, a batch is filled from the highest level down
+const int INFERENCE_PRIORITY_SELF_PLAY = 0;
+// self-play games past half of simulation_max_turns: long games are what keeps a cycle from finishing
+const int INFERENCE_PRIORITY_LONG_GAME = 1;
+const int INFERENCE_PRIORITY_LEVELS = 2;
+
+typedef PriorityBlockingQueue<TModelJob> TModelQueue;
+
+// Where a search sends its states for evaluation. request() fills reply and returns once the result is there,
+// suspending the calling fiber, or blocking the calling thread outside of fibers, in the meantime.
+class InferenceClient {
+public:
+    virtual ~InferenceClient() = default;
+
+    // state is a [1, ...] CPU float tensor and must stay alive until request() returns
+    virtual void request(torch::Tensor &state, InferenceReply &reply, int priority) = 0;
+};
+
+// client of an InferenceServer running in this process
+class QueueInferenceClient : public InferenceClient {
+    TModelQueue &queue;
+
+public:
+    explicit QueueInferenceClient(TModelQueue &queue) : queue(queue) {
+    }
+
+    void request(torch::Tensor &state, InferenceReply &reply, int priority) override {
+        reply.done.reset();
+        queue.enqueue(TModelJob{&state, &reply, inference_clock_us()}, priority);
+        Fiber::await(reply.done);
+    }
+};
+
+// network evaluations (value and legal-move policy) keyed by hash_tensor() of the state. Must be cleared whenever
+// the model behind the inference server changes.
+typedef ShardedLRUCache<MCTSStateActionValue> EvaluationCache;
+
+// how long an idle server sleeps on an empty queue before re-checking the termination flag
+const int INFERENCE_IDLE_WAIT_US = 100000;
+
+// Batches evaluation requests from the search threads and runs them through the model.
+// A batch is fired as soon as it reaches max_batch_size states or max_wait_us microseconds have passed since its
+// first state arrived, whichever comes first. An empty queue is waited on without spinning.
+//
+// Every model replica gets its own worker, and all workers pull from the same queue. A worker is a three stage
+// pipeline passing request buffers around: a collector thread assembles the next batch while the model thread runs
+// the current one, and a reply thread scatters finished results back to the callers. pipeline_buffers bounds the
+// number of batches in flight per worker (2 gives double buffering).
+class InferenceServer {
+    struct RequestContext {
+        std::vector<TModelJob> items;
+        torch::Tensor batch;
+        GameModelOutput model_output;
+        int model_version{0};
+    };
+
+    struct Worker {
+        InferenceModelPtr model;
+        std::vector<RequestContext> buffers;
+        BlockingQueue<RequestContext *> free_buffers;
+        BlockingQueue<RequestContext *> ready_buffers;
+        BlockingQueue<RequestContext *> done_buffers;
+        // replacement model handed over by swap_models, picked up by the model thread between batches
+        std::mutex swap_mutex;
+        InferenceModelPtr next_model;
+        int next_version{0};
+        std::atomic<bool> swap_pending{false};
+        int model_version{0};
+
+        Worker(InferenceModelPtr model, int pipeline_buffers) : model(std::move(model)), buffers(pipeline_buffers) {
+            for (auto &buffer : buffers) {
+                free_buffers.enqueue(&buffer);
+            }
+        }
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    TModelQueue &queue;
+    torch::Device device;
+    int max_batch_size;
+    int max_wait_us;
+    int threads_per_worker;
+
+    bool read_request(RequestContext &request) {
+        using namespace std::chrono;
+        auto &items = request.items;
+        items.resize(max_batch_size);
+        int64_t wait_start = inference_clock_us();
+        size_t size = queue.wait_dequeue_bulk(items.begin(), max_batch_size, INFERENCE_IDLE_WAIT_US);
+        stats.collect_idle_us += inference_clock_us() - wait_start;
+        if (size == 0) {
+            items.clear();
+            return false;
+        }
+        auto deadline = steady_clock::now() + microseconds(max_wait_us);
+        while (size < max_batch_size) {
+            auto remaining = duration_cast<microseconds>(deadline - steady_clock::now()).count();
+            if (remaining <= 0) {
+                break;
+            }
+            size += queue.wait_dequeue_bulk(items.begin() + size, max_batch_size - size, remaining);
+        }
+        items.resize(size);
+        stats.queue_depth.add(queue.size_approx());
+
+        std::vector<torch::Tensor> states;
+        states.reserve(size);
+        for (auto &i : items) {
+            states.push_back(*i.state);
+        }
+        request.batch = torch::cat({&states[0], states.size()}).to(device);
+        return true;
+    }
+
+    void reply(RequestContext &request) {
+        auto &items(request.items);
+        auto &model_output(request.model_output);
+        bool action_value_enabled = model_output.policy.numel() > 0;
+        torch::Tensor policy, value;
+        if (action_value_enabled)
+            policy = model_output.policy.to(torch::kCPU, torch::kFloat).contiguous();
+        value = model_output.value.to(torch::kCPU, torch::kFloat).contiguous();
+        size_t value_size = value.size(1);
+        size_t policy_size = action_value_enabled ? policy.size(1) : 0;
+        int64_t now = inference_clock_us();
+        for (size_t i = 0; i < items.size(); ++i) {
+            auto &r = *items[i].reply;
+            r.value.resize(value_size);
+            std::copy_n(value.data_ptr<float>() + i * value_size, value_size, r.value.begin());
+            r.has_policy = action_value_enabled;
+            r.model_version = request.model_version;
+            if (action_value_enabled) {
+                r.policy.resize(policy_size);
+                std::copy_n(policy.data_ptr<float>() + i * policy_size, policy_size, r.policy.begin());
+            }
+            if (items[i].enqueued_us > 0) {
+                stats.latency_us.add(now - items[i].enqueued_us);
+            }
+            r.complete();
+        }
+    }
+
+    void collect_loop(Worker *worker, std::atomic<bool> *terminated) {
+        torch::NoGradGuard no_grad;
+        RequestContext *request;
+        while (!*terminated) {
+            if (!worker->free_buffers.wait_dequeue(request, INFERENCE_IDLE_WAIT_US)) {
+                continue;
+            }
+            while (!read_request(*request)) {
+                if (*terminated) {
+                    return;
+                }
+            }
+            worker->ready_buffers.enqueue(request);
+        }
+    }
+
+    void model_loop(Worker *worker, std::atomic<bool> *terminated) {
+        torch::NoGradGuard no_grad;
+        RequestContext *request;
+        int64_t idle_start = inference_clock_us();
+        while (!*terminated) {
+            if (worker->ready_buffers.wait_dequeue(request, INFERENCE_IDLE_WAIT_US)) {
+                int64_t start = inference_clock_us();
+                stats.model_idle_us += start - idle_start;
+                if (worker->swap_pending) {
+                    std::lock_guard<std::mutex> lock(worker->swap_mutex);
+                    worker->model = std::move(worker->next_model);
+                    worker->model_version = worker->next_version;
+                    worker->swap_pending = false;
+                }
+                request->model_version = worker->model_version;
+                request->model_output = worker->model->forward(request->batch);
+                // on CUDA this only covers the kernel launches, the reply stage waits for the results
+                idle_start = inference_clock_us();
+                stats.forward_us.add(idle_start - start);
+                stats.model_busy_us += idle_start - start;
+                worker->done_buffers.enqueue(request);
+            }
+        }
+    }
+
+    void reply_loop(Worker *worker, std::atomic<bool> *terminated) {
+        RequestContext *request;
+        while (!*terminated) {
+            if (worker->done_buffers.wait_dequeue(request, INFERENCE_IDLE_WAIT_US)) {
+                reply(*request);
+                stats.add_batch((int) request->items.size());
+                worker->free_buffers.enqueue(request);
+            }
+        }
+    }
+
+public:
+    InferenceStats stats;
+    // latest version handed to swap_models, 0 for the replicas the server was created with
+    std::atomic<int> model_version{0};
+
+    // threads_per_worker > 0 sets the process-wide libtorch intra-op thread count when run() starts, <= 0 keeps the
+    // default
+    InferenceServer(const std::vector<InferenceModelPtr> &replicas, TModelQueue &queue, torch::Device device,
+                    int max_batch_size, int max_wait_us, int pipeline_buffers = 2, int threads_per_worker = 0)
+            : queue(queue),
+              device(device),
+              max_batch_size(max_batch_size),
+              max_wait_us(max_wait_us),
+              threads_per_worker(threads_per_worker),
+              stats(max_batch_size) {
+        for (auto &replica : replicas) {
+            // callers only use the policy through to_state_action_value, which renormalizes over the legal actions
+            replica->raw_policy = true;
+            workers.emplace_back(new Worker(replica, std::max(1, pipeline_buffers)));
+        }
+    }
+
+    int worker_count() const {
+        return (int) workers.size();
+    }
+
+    // Replaces the model of every worker, replicas[i] going to worker i. The replicas are moved to the device by the
+    // caller thread; each model thread switches before its next batch, so a batch never mixes versions.
+    void swap_models(const std::vector<InferenceModelPtr> &replicas, int version) {
+        for (size_t i = 0; i < workers.size(); ++i) {
+            auto &worker = *workers[i];
+            auto &replica = replicas[i % replicas.size()];
+            replica->raw_policy = true;
+            replica->to(device);
+            std::lock_guard<std::mutex> lock(worker.swap_mutex);
+            worker.next_model = replica;
+            worker.next_version = version;
+            worker.swap_pending = true;
+        }
+        model_version = version;
+    }
+
+    void run(std::atomic<bool> *terminated) {
+        if (threads_per_worker > 0) {
+            // the intra-op thread count is process-wide, so it is set once before any worker runs a forward pass
+            torch::set_num_threads(threads_per_worker);
+        }
+        std::vector<std::thread> threads;
+        for (auto &worker : workers) {
+            worker->model->to(device);
+            threads.emplace_back(&InferenceServer::collect_loop, this, worker.get(), terminated);
+            threads.emplace_back(&InferenceServer::model_loop, this, worker.get(), terminated);
+            threads.emplace_back(&InferenceServer::reply_loop, this, worker.get(), terminated);
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+    }
+};
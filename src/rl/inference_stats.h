@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <tensorboard_logger.h>
+#include "../util/histogram.h"
+
+
+// microseconds on the steady clock, used to timestamp inference requests
+inline int64_t inference_clock_us() {
+    using namespace std::chrono;
+    return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Counters updated by the inference server threads. All of them are cumulative; InferenceStatsReporter turns them
+// into per-interval figures.
+struct InferenceStats {
+    std::atomic<long> requests{0};
+    std::atomic<long> batches{0};
+    // batch_sizes[n] is the number of forward passes executed on a batch of n states
+    std::vector<std::atomic<long>> batch_sizes;
+    // enqueue to reply of every request, microseconds
+    Log2Histogram latency_us;
+    // model forward pass of every batch, microseconds
+    Log2Histogram forward_us;
+    // requests still waiting in the queue when a batch has been collected
+    Log2Histogram queue_depth;
+    // time the collectors waited on an empty queue and the model threads waited for a collected batch
+    std::atomic<long> collect_idle_us{0};
+    std::atomic<long> model_idle_us{0};
+    std::atomic<long> model_busy_us{0};
+
+    explicit InferenceStats(int max_batch_size) : batch_sizes(max_batch_size + 1) {
+    }
+
+    void add_batch(int batch_size) {
+        requests += batch_size;
+        batches++;
+        batch_sizes[batch_size]++;
+    }
+
+    float mean_batch_size() const {
+        return batches > 0 ? (float) requests / (float) batches : 0.f;
+    }
+
+    void print(std::ostream &os) const {
+        auto latency = latency_us.counts();
+        auto forward = forward_us.counts();
+        os << "Inference requests: " << requests << ". Batches: " << batches << ". Mean batch size: "
+           << mean_batch_size() << std::endl;
+        os << "  latency us p50/p90/p99: " << Log2Histogram::percentile(latency, 0.5) << "/"
+           << Log2Histogram::percentile(latency, 0.9) << "/" << Log2Histogram::percentile(latency, 0.99)
+           << ". Forward us p50/p99: " << Log2Histogram::percentile(forward, 0.5) << "/"
+           << Log2Histogram::percentile(forward, 0.99) << ". Queue depth p50/p99: "
+           << Log2Histogram::percentile(queue_depth.counts(), 0.5) << "/"
+           << Log2Histogram::percentile(queue_depth.counts(), 0.99) << std::endl;
+        os << "  model busy s: " << model_busy_us / 1e6 << ". Model idle s: " << model_idle_us / 1e6
+           << ". Collector idle s: " << collect_idle_us / 1e6 << std::endl;
+        for (int i = 1; i < batch_sizes.size(); ++i) {
+            if (batch_sizes[i] > 0) {
+                os << "  batch size " << i << ": " << batch_sizes[i] << std::endl;
+            }
+        }
+    }
+};
+
+
+// Exports InferenceStats at every report() call, covering the interval since the previous call: scalars and the
+// batch size distribution go to TensorBoard, one whitespace separated line per interval to a text file.
+class InferenceStatsReporter {
+    struct Snapshot {
+        int64_t time_us{0};
+        long requests{0};
+        long batches{0};
+        std::vector<long> batch_sizes;
+        Log2Histogram::Counts latency_us{};
+        Log2Histogram::Counts forward_us{};
+        Log2Histogram::Counts queue_depth{};
+        long collect_idle_us{0};
+        long model_idle_us{0};
+        long model_busy_us{0};
+    };
+
+    const InferenceStats &stats;
+    TensorBoardLogger *logger;
+    std::ofstream file;
+    Snapshot previous;
+    int step{0};
+
+    Snapshot snapshot() const {
+        Snapshot s;
+        s.time_us = inference_clock_us();
+        s.requests = stats.requests;
+        s.batches = stats.batches;
+        for (auto &b : stats.batch_sizes) {
+            s.batch_sizes.push_back(b);
+        }
+        s.latency_us = stats.latency_us.counts();
+        s.forward_us = stats.forward_us.counts();
+        s.queue_depth = stats.queue_depth.counts();
+        s.collect_idle_us = stats.collect_idle_us;
+        s.model_idle_us = stats.model_idle_us;
+        s.model_busy_us = stats.model_busy_us;
+        return s;
+    }
+
+public:
+    // logger may be null; an empty file_name disables the text output
+    InferenceStatsReporter(const InferenceStats &stats, TensorBoardLogger *logger, const std::string &file_name) :
+            stats(stats), logger(logger), previous(snapshot()) {
+        if (!file_name.empty()) {
+            file.open(file_name, std::ios::app);
+            file << "step seconds requests_per_sec mean_batch_size latency_p50_us latency_p90_us latency_p99_us "
+                    "forward_p50_us forward_p99_us queue_depth_p50 queue_depth_p99 model_utilization "
+                    "collector_idle" << std::endl;
+        }
+    }
+
+    void report() {
+        auto current = snapshot();
+        double seconds = std::max<int64_t>(1, current.time_us - previous.time_us) / 1e6;
+        long requests = current.requests - previous.requests;
+        long batches = current.batches - previous.batches;
+        auto latency = Log2Histogram::subtract(current.latency_us, previous.latency_us);
+        auto forward = Log2Histogram::subtract(current.forward_us, previous.forward_us);
+        auto depth = Log2Histogram::subtract(current.queue_depth, previous.queue_depth);
+        long busy = current.model_busy_us - previous.model_busy_us;
+        long idle = current.model_idle_us - previous.model_idle_us;
+        // share of the interval the model threads spent in forward passes, and the collectors spent waiting
+        float utilization = busy + idle > 0 ? (float) busy / (float) (busy + idle) : 0.f;
+        float collector_idle = (float) ((current.collect_idle_us - previous.collect_idle_us) / 1e6 / seconds);
+        float requests_per_sec = (float) (requests / seconds);
+        float mean_batch_size = batches > 0 ? (float) requests / (float) batches : 0.f;
+
+        if (logger) {
+            logger->add_scalar("inference/requests_per_sec", step, requests_per_sec);
+            logger->add_scalar("inference/mean_batch_size", step, mean_batch_size);
+            logger->add_scalar("inference/latency_p50_us", step, (float) Log2Histogram::percentile(latency, 0.5));
+            logger->add_scalar("inference/latency_p90_us", step, (float) Log2Histogram::percentile(latency, 0.9));
+            logger->add_scalar("inference/latency_p99_us", step, (float) Log2Histogram::percentile(latency, 0.99));
+            logger->add_scalar("inference/forward_p50_us", step, (float) Log2Histogram::percentile(forward, 0.5));
+            logger->add_scalar("inference/queue_depth_p50", step, (float) Log2Histogram::percentile(depth, 0.5));
+            logger->add_scalar("inference/queue_depth_p99", step, (float) Log2Histogram::percentile(depth, 0.99));
+            logger->add_scalar("inference/model_utilization", step, utilization);
+            logger->add_scalar("inference/collector_idle", step, collector_idle);
+            std::vector<float> sizes;
+            for (int i = 1; i < current.batch_sizes.size(); ++i) {
+                sizes.insert(sizes.end(), current.batch_sizes[i] - previous.batch_sizes[i], (float) i);
+            }
+            if (!sizes.empty()) {
+                logger->add_histogram("inference/batch_size", step, sizes);
+            }
+        }
+        if (file.is_open()) {
+            file << step << " " << seconds << " " << requests_per_sec << " " << mean_batch_size << " "
+                 << Log2Histogram::percentile(latency, 0.5) << " " << Log2Histogram::percentile(latency, 0.9) << " "
+                 << Log2Histogram::percentile(latency, 0.99) << " " << Log2Histogram::percentile(forward, 0.5) << " "
+                 << Log2Histogram::percentile(forward, 0.99) << " " << Log2Histogram::percentile(depth, 0.5) << " "
+                 << Log2Histogram::percentile(depth, 0.99) << " " << utilization << " " << collector_idle
+                 << std::endl;
+        }
+        previous = std::move(current);
+        step++;
+    }
+};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <unordered_map>
 #include <ATen/core/Tensor.h>
@@ -13,3 +14,55 @@ struct GameModelOutput {
     torch::Tensor value;
 };
 
+
+// Model executed by the inference server workers. Implementations run in inference mode only.
+class InferenceModel {
+public:
+    // When set, forward may return unnormalized policy logits instead of log-probabilities. Callers that renormalize
+    // over the legal actions anyway set it to skip the softmax over the whole action space.
+    bool raw_policy{false};
+
+    virtual ~InferenceModel() = default;
+
+    virtual void to(torch::Device device) = 0;
+
+    virtual GameModelOutput forward(const torch::Tensor &batch) = 0;
+};
+
+typedef std::shared_ptr<InferenceModel> InferenceModelPtr;
+
+
+// Plain libtorch module such as JackalModel, switched to eval mode
+template<class TModel>
+class TorchInferenceModel : public InferenceModel {
+    TModel model;
+
+public:
+    explicit TorchInferenceModel(TModel model) : model(std::move(model)) {
+        this->model->eval();
+    }
+
+    void to(torch::Device device) override {
+        model->to(device);
+    }
+
+    GameModelOutput forward(const torch::Tensor &batch) override {
+        return model(batch);
+    }
+};
+
+
+
+// Copies parameters and buffers between two models of identical architecture, e.g. to build inference replicas.
+template<class TModel>
+void copy_weights(TModel &from, TModel &to) {
+    torch::NoGradGuard no_grad;
+    auto to_params = to->named_parameters();
+    for (auto &kv : from->named_parameters()) {
+        to_params[kv.key()].copy_(kv.value());
+    }
+    auto to_buffers = to->named_buffers();
+    for (auto &kv : from->named_buffers()) {
+        to_buffers[kv.key()].copy_(kv.value());
+    }
+}
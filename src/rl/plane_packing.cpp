@@ -0,0 +1,148 @@
+#include "plane_packing.h"
+
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace {
+
+    int64_t packed_plane_bytes(int8_t bits, int64_t plane_size) {
+        return (plane_size * bits + 7) / 8;
+    }
+
+    void unpack_plane_scalar(int8_t bits, const uint8_t *in, int64_t n, float *out) {
+        switch (bits) {
+            case PLANE_BITS_BINARY:
+                for (int64_t i = 0; i < n; ++i) {
+                    out[i] = (float) ((in[i >> 3] >> (i & 7)) & 1);
+                }
+                break;
+            case PLANE_BITS_NIBBLE:
+                for (int64_t i = 0; i < n; ++i) {
+                    out[i] = (float) ((in[i >> 1] >> ((i & 1) * 4)) & 15);
+                }
+                break;
+            default:
+                for (int64_t i = 0; i < n; ++i) {
+                    out[i] = (float) (int8_t) in[i];
+                }
+        }
+    }
+
+    // Expands 8 values per iteration and leaves the tail of the plane to the scalar loop
+    __attribute__((target("avx2")))
+    void unpack_plane_avx2(int8_t bits, const uint8_t *in, int64_t n, float *out) {
+        int64_t i = 0;
+        switch (bits) {
+            case PLANE_BITS_BINARY: {
+                const __m256i masks = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+                const __m256 one = _mm256_set1_ps(1.f);
+                for (; i + 8 <= n; i += 8) {
+                    __m256i v = _mm256_and_si256(_mm256_set1_epi32(in[i >> 3]), masks);
+                    __m256i set = _mm256_cmpeq_epi32(v, masks);
+                    _mm256_storeu_ps(out + i, _mm256_and_ps(_mm256_castsi256_ps(set), one));
+                }
+                break;
+            }
+            case PLANE_BITS_NIBBLE: {
+                const __m256i shifts = _mm256_setr_epi32(0, 4, 8, 12, 16, 20, 24, 28);
+                const __m256i nibble = _mm256_set1_epi32(15);
+                for (; i + 8 <= n; i += 8) {
+                    uint32_t word;
+                    std::memcpy(&word, in + (i >> 1), 4);
+                    __m256i v = _mm256_srlv_epi32(_mm256_set1_epi32((int) word), shifts);
+                    _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_and_si256(v, nibble)));
+                }
+                break;
+            }
+            default:
+                for (; i + 8 <= n; i += 8) {
+                    __m128i v = _mm_loadl_epi64((const __m128i *) (in + i));
+                    _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(v)));
+                }
+        }
+        // i is a multiple of 8, so the tail starts on a byte boundary for every width
+        unpack_plane_scalar(bits, in + i * bits / 8, n - i, out + i);
+    }
+
+    typedef void (*UnpackKernel)(int8_t bits, const uint8_t *in, int64_t n, float *out);
+
+    UnpackKernel select_unpack_kernel() {
+        static const UnpackKernel kernel = []() {
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") ? unpack_plane_avx2 : unpack_plane_scalar;
+        }();
+        return kernel;
+    }
+}
+
+
+PlanePacking::PlanePacking(std::vector<int8_t> bits, int64_t plane_size) : bits(std::move(bits)),
+                                                                          plane_size(plane_size) {
+    for (auto b : this->bits) {
+        if (b != PLANE_BITS_BINARY && b != PLANE_BITS_NIBBLE && b != PLANE_BITS_BYTE) {
+            throw std::runtime_error("unsupported plane width " + std::to_string(b));
+        }
+        plane_offsets.push_back(bytes);
+        bytes += packed_plane_bytes(b, plane_size);
+    }
+}
+
+std::vector<int8_t> PlanePacking::fit(const float *x, int64_t rows, int64_t planes, int64_t plane_size) {
+    std::vector<int8_t> result(planes, PLANE_BITS_BINARY);
+    for (int64_t r = 0; r < rows; ++r) {
+        for (int64_t p = 0; p < planes; ++p) {
+            const float *plane = x + (r * planes + p) * plane_size;
+            for (int64_t i = 0; i < plane_size; ++i) {
+                float v = plane[i];
+                if (v == 0.f || v == 1.f) {
+                    continue;
+                }
+                if (v != std::round(v) || v < -128.f || v > 127.f) {
+                    return {};
+                }
+                int8_t needed = v >= 0.f && v <= 15.f ? PLANE_BITS_NIBBLE : PLANE_BITS_BYTE;
+                if (needed > result[p]) {
+                    result[p] = needed;
+                }
+            }
+        }
+    }
+    return result;
+}
+
+void PlanePacking::pack(const float *x, int64_t rows, uint8_t *out) const {
+    std::memset(out, 0, rows * bytes);
+    for (int64_t r = 0; r < rows; ++r) {
+        for (size_t p = 0; p < bits.size(); ++p) {
+            const float *plane = x + (r * (int64_t) bits.size() + (int64_t) p) * plane_size;
+            uint8_t *o = out + r * bytes + plane_offsets[p];
+            for (int64_t i = 0; i < plane_size; ++i) {
+                auto v = (int) plane[i];
+                switch (bits[p]) {
+                    case PLANE_BITS_BINARY:
+                        o[i >> 3] |= (uint8_t) ((v & 1) << (i & 7));
+                        break;
+                    case PLANE_BITS_NIBBLE:
+                        o[i >> 1] |= (uint8_t) ((v & 15) << ((i & 1) * 4));
+                        break;
+                    default:
+                        o[i] = (uint8_t) (int8_t) v;
+                }
+            }
+        }
+    }
+}
+
+void PlanePacking::unpack(const uint8_t *in, int64_t rows, float *x) const {
+    auto kernel = select_unpack_kernel();
+    for (int64_t r = 0; r < rows; ++r) {
+        for (size_t p = 0; p < bits.size(); ++p) {
+            kernel(bits[p], in + r * bytes + plane_offsets[p], plane_size,
+                   x + (r * (int64_t) bits.size() + (int64_t) p) * plane_size);
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+
+// storage widths of a packed plane
+const int8_t PLANE_BITS_BINARY = 1;
+const int8_t PLANE_BITS_NIBBLE = 4;
+const int8_t PLANE_BITS_BYTE = 8;
+
+
+// Compact storage for rows of game state planes whose values are small integers. Every plane is stored with its own
+// width: a bitmask for 0/1 planes, a nibble per value for counts up to 15 and a signed byte otherwise. The planes of a
+// row follow each other, each starting on a byte boundary, so rows have a fixed width of row_bytes().
+// unpack() is the hot path of the data loader and uses AVX2 when the CPU has it.
+class PlanePacking {
+    std::vector<int8_t> bits;
+    int64_t plane_size{0};
+    std::vector<int64_t> plane_offsets;
+    int64_t bytes{0};
+
+public:
+    PlanePacking() = default;
+
+    PlanePacking(std::vector<int8_t> bits, int64_t plane_size);
+
+    // Narrowest width of each of the planes over rows rows of planes x plane_size floats. Empty when some value is not
+    // an integer in [-128, 127], in which case the rows cannot be packed.
+    static std::vector<int8_t> fit(const float *x, int64_t rows, int64_t planes, int64_t plane_size);
+
+    const std::vector<int8_t> &plane_bits() const {
+        return bits;
+    }
+
+    int64_t row_bytes() const {
+        return bytes;
+    }
+
+    // packs rows rows of floats into rows * row_bytes() bytes
+    void pack(const float *x, int64_t rows, uint8_t *out) const;
+
+    void unpack(const uint8_t *in, int64_t rows, float *x) const;
+};
@@ -1,19 +1,41 @@
 #include "play.h"
 
+#include <algorithm>
+#include <cmath>
 
-MCTSActionValue filter_renormalize_actions(torch::Tensor tensor, const std::vector<int> &actions) {
-    MCTSActionValue result;
+
+void filter_renormalize_actions(const float *policy, const std::vector<int> &actions, MCTSActionValue &result) {
+    result.clear();
     if (actions.empty()) {
-        return result;
+        return;
     }
-    auto actions_tensor = torch::from_blob((int *) &actions[0], at::IntArrayRef({(int) actions.size()}),
-                                           torch::kInt).clone().to(torch::kInt64);
-    auto proba_tensor = tensor.softmax(0).index({actions_tensor}).contiguous();
-    proba_tensor /= std::max(proba_tensor.sum().item<float>(), (float) 1e-8);
-    std::vector<float> proba(proba_tensor.data_ptr<float>(), proba_tensor.data_ptr<float>() + proba_tensor.numel());
-    for (int i = 0; i < actions.size(); ++i) {
-        result[actions[i]] = proba[i];
+    // per thread scratch so that the gather and exp loops run over contiguous floats without allocating
+    thread_local std::vector<float> proba;
+    proba.resize(actions.size());
+    for (size_t i = 0; i < actions.size(); ++i) {
+        proba[i] = policy[actions[i]];
+    }
+    float max = *std::max_element(proba.begin(), proba.end());
+    float sum = 0;
+    for (float &p : proba) {
+        p = std::exp(p - max);
+        sum += p;
+    }
+    float scale = 1.f / std::max(sum, 1e-8f);
+    result.reserve(actions.size());
+    for (size_t i = 0; i < actions.size(); ++i) {
+        result[actions[i]] = proba[i] * scale;
         assert(proba[i] == proba[i]);
     }
+}
+
+MCTSActionValue filter_renormalize_actions(const float *policy, const std::vector<int> &actions) {
+    MCTSActionValue result;
+    filter_renormalize_actions(policy, actions, result);
     return result;
 }
+
+MCTSActionValue filter_renormalize_actions(torch::Tensor tensor, const std::vector<int> &actions) {
+    auto policy = tensor.to(torch::kCPU, torch::kFloat).contiguous();
+    return filter_renormalize_actions(policy.data_ptr<float>(), actions);
+}
@@ -4,23 +4,47 @@
 #include "model.h"
 
 
+// Probabilities of the legal actions: the softmax of the policy restricted to actions. The policy may hold logits or
+// log-probabilities, they only differ by a constant. Plain C++ over the legal entries, no tensor ops.
+MCTSActionValue filter_renormalize_actions(const float *policy, const std::vector<int> &actions);
+
+// Same, written into result, which is cleared first; a result that is reused keeps its buckets, so refilling it with
+// no more actions than it held before does not allocate them again.
+void filter_renormalize_actions(const float *policy, const std::vector<int> &actions, MCTSActionValue &result);
+
 MCTSActionValue filter_renormalize_actions(torch::Tensor tensor, const std::vector<int> &actions);
 
+// value holds one entry per player, policy is a full action space row or nullptr when the model has no policy head
+template<class T>
+MCTSStateActionValue to_state_action_value(const float *value, int players, const float *policy, const T &game_state) {
+    // filled in place: the search tree keeps the result as the prior of a new node
+    MCTSStateActionValue result{MCTSStateValue(value, value + players), {}};
+    if (policy) {
+        filter_renormalize_actions(policy, game_state.get_possible_actions(), result.action_proba);
+    }
+    return result;
+}
+
+// First row of a model output as a CPU float tensor that can be read through data_ptr. Rows replied by the inference
+// server already have that layout and are returned as is.
+inline torch::Tensor cpu_float_row(const torch::Tensor &t) {
+    auto row = t[0];
+    if (row.device().is_cpu() && row.scalar_type() == torch::kFloat && row.is_contiguous()) {
+        return row;
+    }
+    return row.to(torch::kCPU, torch::kFloat).contiguous();
+}
+
 template<class T>
 MCTSStateActionValue to_state_action_value(GameModelOutput &output, const T &game_state) {
     bool policy_enabled = output.policy.numel() > 0;
     assert(output.value.dim() == 2);
-    auto value = output.value.to(torch::kCPU)[0];
-
-    MCTSActionValue action_proba;
+    auto value = cpu_float_row(output.value);
+    torch::Tensor policy;
     if (policy_enabled) {
         assert(output.policy.dim() == 2);
-        auto policy = output.policy.to(torch::kCPU)[0];
-        auto actions = game_state.get_possible_actions();
-        action_proba = filter_renormalize_actions(policy, actions);
+        policy = cpu_float_row(output.policy);
     }
-    return MCTSStateActionValue {
-            MCTSStateValue(value.data_ptr<float>(), value.data_ptr<float>() + value.numel()),
-            action_proba
-    };
+    return to_state_action_value(value.data_ptr<float>(), (int) value.numel(),
+                                 policy_enabled ? policy.data_ptr<float>() : nullptr, game_state);
 }
@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <vector>
+#include <torch/torch.h>
+#include "plane_packing.h"
+
+
+// A batch of positions drawn from a ReplayBuffer, shaped like a SelfPlayDataset example
+struct ReplayBatch {
+    torch::Tensor x;
+    torch::Tensor action;
+    torch::Tensor state_value;
+    torch::Tensor model_version;
+};
+
+
+// Sliding window over the most recent capacity training positions. Positions are kept in a ring in the order they
+// were added, so once the buffer is full every new position evicts the oldest one.
+// States are kept as PlanePacking rows while their values are small integers; a position that needs a wider plane
+// re-packs the buffer, and a non-integer one switches it to float rows for good.
+// Sampling is uniform, or proportional to per-position weights once set_weights() built an alias table for them; both
+// take O(1) per position.
+class ReplayBuffer {
+    int64_t capacity;
+    std::vector<int64_t> state_shape;
+    int64_t planes{0};
+    int64_t plane_size{0};
+    int value_size{0};
+    // empty bits store float rows
+    PlanePacking packing;
+    bool packed{true};
+    bool initialized{false};
+    int64_t row_bytes{0};
+
+    std::vector<uint8_t> states;
+    std::vector<int64_t> actions;
+    std::vector<float> values;
+    std::vector<int32_t> model_versions;
+    // ring slot of the oldest position
+    int64_t start{0};
+    int64_t count{0};
+
+    // alias table over the logical positions 0..count-1, empty for uniform sampling
+    std::vector<float> alias_probability;
+    std::vector<int64_t> alias;
+
+    int64_t slot(int64_t position) const {
+        return (start + position) % capacity;
+    }
+
+    void unpack_row(int64_t slot, float *out) const {
+        const uint8_t *row = states.data() + slot * row_bytes;
+        if (packed) {
+            packing.unpack(row, 1, out);
+        } else {
+            std::memcpy(out, row, row_bytes);
+        }
+    }
+
+    // switches the state storage to a new packing, or to float rows when bits is empty
+    void repack(const std::vector<int8_t> &bits) {
+        std::vector<float> row(planes * plane_size);
+        PlanePacking new_packing = bits.empty() ? PlanePacking() : PlanePacking(bits, plane_size);
+        int64_t new_row_bytes = bits.empty() ? (int64_t) row.size() * 4 : new_packing.row_bytes();
+        std::vector<uint8_t> new_states(capacity * new_row_bytes);
+        for (int64_t p = 0; p < count; ++p) {
+            unpack_row(slot(p), row.data());
+            uint8_t *out = new_states.data() + slot(p) * new_row_bytes;
+            if (bits.empty()) {
+                std::memcpy(out, row.data(), new_row_bytes);
+            } else {
+                new_packing.pack(row.data(), 1, out);
+            }
+        }
+        packing = new_packing;
+        packed = !bits.empty();
+        row_bytes = new_row_bytes;
+        states = std::move(new_states);
+    }
+
+    void init(const torch::Tensor &x, const torch::Tensor &state_value) {
+        state_shape.assign(x.sizes().begin() + 1, x.sizes().end());
+        planes = state_shape.empty() ? 1 : state_shape[0];
+        plane_size = 1;
+        for (size_t d = 1; d < state_shape.size(); ++d) {
+            plane_size *= state_shape[d];
+        }
+        value_size = (int) (state_value.numel() / x.size(0));
+        packing = PlanePacking(std::vector<int8_t>(planes, PLANE_BITS_BINARY), plane_size);
+        row_bytes = packing.row_bytes();
+        states.assign(capacity * row_bytes, 0);
+        actions.assign(capacity, 0);
+        values.assign(capacity * value_size, 0.f);
+        model_versions.assign(capacity, -1);
+        initialized = true;
+    }
+
+public:
+    explicit ReplayBuffer(int64_t capacity) : capacity(std::max<int64_t>(1, capacity)) {
+    }
+
+    int64_t size() const {
+        return count;
+    }
+
+    int64_t max_size() const {
+        return capacity;
+    }
+
+    // bytes held by the stored states
+    int64_t state_bytes() const {
+        return (int64_t) states.size();
+    }
+
+    bool is_packed() const {
+        return packed;
+    }
+
+    // newest model version among the stored positions, -1 when none is known
+    int32_t newest_model_version() const {
+        int32_t newest = -1;
+        for (int64_t p = 0; p < count; ++p) {
+            newest = std::max(newest, model_versions[slot(p)]);
+        }
+        return newest;
+    }
+
+    // Appends a batch of positions: x is [rows, state...], action [rows], state_value [rows, value_size] and
+    // model_version [rows] or undefined. Drops the weights set by set_weights().
+    void add(const torch::Tensor &x, const torch::Tensor &action, const torch::Tensor &state_value,
+             const torch::Tensor &model_version) {
+        int64_t rows = x.size(0);
+        if (rows == 0) {
+            return;
+        }
+        if (!initialized) {
+            init(x, state_value);
+        }
+        auto fx = x.to(torch::kCPU, torch::kFloat32).contiguous();
+        if (fx.numel() != rows * planes * plane_size) {
+            throw std::runtime_error("replay buffer positions must all have the same state shape");
+        }
+        if (packed) {
+            auto bits = PlanePacking::fit(fx.data_ptr<float>(), rows, planes, plane_size);
+            if (bits.empty()) {
+                repack({});
+            } else {
+                bool wider = false;
+                for (int64_t p = 0; p < planes; ++p) {
+                    wider |= bits[p] > packing.plane_bits()[p];
+                    bits[p] = std::max(bits[p], packing.plane_bits()[p]);
+                }
+                if (wider) {
+                    repack(bits);
+                }
+            }
+        }
+        auto a = action.to(torch::kCPU, torch::kInt64).contiguous();
+        auto v = state_value.to(torch::kCPU, torch::kFloat32).contiguous();
+        auto mv = model_version.defined() ? model_version.to(torch::kCPU, torch::kInt32).contiguous()
+                                          : torch::full({rows}, -1, torch::kInt32);
+        const float *xp = fx.data_ptr<float>();
+        const int64_t *ap = a.data_ptr<int64_t>();
+        const int32_t *mvp = mv.data_ptr<int32_t>();
+        for (int64_t r = 0; r < rows; ++r) {
+            int64_t s;
+            if (count < capacity) {
+                s = slot(count++);
+            } else {
+                s = start;
+                start = (start + 1) % capacity;
+            }
+            const float *row = xp + r * planes * plane_size;
+            uint8_t *out = states.data() + s * row_bytes;
+            if (packed) {
+                packing.pack(row, 1, out);
+            } else {
+                std::memcpy(out, row, row_bytes);
+            }
+            actions[s] = ap[r];
+            std::memcpy(&values[s * value_size], v.data_ptr<float>() + r * value_size, value_size * sizeof(float));
+            model_versions[s] = mvp[r];
+        }
+        alias_probability.clear();
+        alias.clear();
+    }
+
+    // Builds the alias table for sampling positions in proportion to weight(model_version); uniform sampling is
+    // restored by add() or by clear_weights().
+    void set_weights(const std::function<float(int32_t model_version)> &weight) {
+        std::vector<double> w(count);
+        double total = 0;
+        for (int64_t p = 0; p < count; ++p) {
+            w[p] = std::max(0.f, weight(model_versions[slot(p)]));
+            total += w[p];
+        }
+        if (total <= 0) {
+            throw std::runtime_error("replay buffer weights are all zero");
+        }
+        // Vose's alias method
+        alias_probability.assign(count, 1.f);
+        alias.resize(count);
+        std::vector<int64_t> small, large;
+        for (int64_t p = 0; p < count; ++p) {
+            w[p] *= (double) count / total;
+            alias[p] = p;
+            (w[p] < 1. ? small : large).push_back(p);
+        }
+        while (!small.empty() && !large.empty()) {
+            int64_t s = small.back(), l = large.back();
+            small.pop_back();
+            alias_probability[s] = (float) w[s];
+            alias[s] = l;
+            w[l] -= 1. - w[s];
+            if (w[l] < 1.) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+    }
+
+    void clear_weights() {
+        alias_probability.clear();
+        alias.clear();
+    }
+
+    // draws batch_size positions with replacement
+    ReplayBatch sample(int64_t batch_size, std::default_random_engine &generator) const {
+        if (count == 0) {
+            throw std::runtime_error("sampling an empty replay buffer");
+        }
+        std::vector<int64_t> x_shape{batch_size};
+        x_shape.insert(x_shape.end(), state_shape.begin(), state_shape.end());
+        ReplayBatch batch{torch::empty(x_shape, torch::kFloat32), torch::empty({batch_size}, torch::kInt64),
+                          torch::empty({batch_size, value_size}, torch::kFloat32),
+                          torch::empty({batch_size}, torch::kInt32)};
+        std::uniform_int_distribution<int64_t> position(0, count - 1);
+        std::uniform_real_distribution<float> coin(0.f, 1.f);
+        float *x = batch.x.data_ptr<float>();
+        for (int64_t i = 0; i < batch_size; ++i) {
+            int64_t p = position(generator);
+            if (!alias.empty() && coin(generator) >= alias_probability[p]) {
+                p = alias[p];
+            }
+            int64_t s = slot(p);
+            unpack_row(s, x + i * planes * plane_size);
+            batch.action.data_ptr<int64_t>()[i] = actions[s];
+            std::memcpy(batch.state_value.data_ptr<float>() + i * value_size, &values[s * value_size],
+                        value_size * sizeof(float));
+            batch.model_version.data_ptr<int32_t>()[i] = model_versions[s];
+        }
+        return batch;
+    }
+};
@@ -1,5 +1,8 @@
 #pragma  once
 
+#include <algorithm>
+#include <cmath>
+#include <functional>
 #include <vector>
 #include <unordered_map>
 #include <ATen/core/Tensor.h>
@@ -16,6 +19,13 @@ struct SelfPlayResult {
     std::vector<MCTSStateActionValue> state_action_values;
     std::vector<torch::Tensor> states;
     MCTSStateValue self_play_reward;
+    // oldest version of the inference model that evaluated a position of this game, -1 when not tracked
+    int model_version{-1};
+    // player who resigned, -1 if the game was not resigned
+    int resigned_player{-1};
+    // in a no-resign calibration game, the first player whose resignation rule fired, -1 if none
+    int would_resign_player{-1};
+    bool adjudicated_draw{false};
 
     void add_state(const torch::Tensor &state, const MCTSStateActionValue &action_value) {
         state_action_values.push_back(action_value);
@@ -29,18 +39,56 @@ struct SelfPlayResult {
 };
 
 
+// Ends self-play games early from the root values of the search
+struct SelfPlayAdjudication {
+    // a player resigns after resign_moves consecutive moves of theirs with a root value below resign_threshold;
+    // 0 moves disables resignation
+    float resign_threshold{-0.9f};
+    int resign_moves{0};
+    // calibration game: resignation only records who would have resigned and the game is played out, so that the
+    // rate of wrong resignations can be measured
+    bool no_resign{false};
+    // the game is a draw once every player's root value stayed within draw_threshold of 0 for draw_moves consecutive
+    // moves; 0 moves disables draw adjudication
+    float draw_threshold{0.05f};
+    int draw_moves{0};
+};
+
+// Reward of a resigned game: the resigning player loses; with two players the opponent wins, with more the others
+// get a neutral 0 since there is no winner to pick
+inline MCTSStateValue resignation_reward(int players, int resigned_player) {
+    MCTSStateValue reward(players, 0.f);
+    reward[resigned_player] = -1.f;
+    if (players == 2) {
+        reward[1 - resigned_player] = 1.f;
+    }
+    return reward;
+}
+
+
+// Plays game to the end with MCTS. A game resumed from a checkpoint passes the moves recorded so far as history;
+// on_turn, when set, is called after every move with the new position and the record including that move.
+// adjudication may end the game early by resignation or draw before its last move.
 template<class TGame, class F>
 SelfPlayResult
 mcts_model_self_play(TGame game, F state_action_value_func, int mcts_steps, int max_turns, float temperature,
                      float exploration,
                      int uct,
                      std::atomic<int> *turns = nullptr, TensorBoardLogger *logger = nullptr,
-                     bool verbose = false) {
+                     bool verbose = false, SelfPlayResult history = SelfPlayResult(),
+                     const std::function<void(const TGame &, const SelfPlayResult &)> &on_turn = nullptr,
+                     const SelfPlayAdjudication &adjudication = SelfPlayAdjudication()) {
     torch::NoGradGuard no_grad;
-    SelfPlayResult self_play_result;
+    SelfPlayResult self_play_result(std::move(history));
     MCTSStateActionValue state_action_value;
+    if (!self_play_result.state_action_values.empty()) {
+        state_action_value = self_play_result.state_action_values.back();
+    }
 
-    int turn = 0;
+    int turn = (int) self_play_result.states.size();
+    // consecutive moves of each player below the resignation threshold, and of all players near 0
+    std::vector<int> low_value_moves;
+    int quiet_moves = 0;
     std::string img_dir;
     while (turn < max_turns && !game.get_possible_actions().empty()) {
         state_action_value = mcts_search(
@@ -55,6 +103,31 @@ mcts_model_self_play(TGame game, F state_action_value_func, int mcts_steps, int
         if (logger) {
             state_action_value.log(logger, turn, temperature);
         }
+        const auto &value = state_action_value.state_value;
+        int player = game.get_current_player_id();
+        if (adjudication.resign_moves > 0 && player < (int) value.size()) {
+            low_value_moves.resize(value.size());
+            low_value_moves[player] = value[player] < adjudication.resign_threshold ? low_value_moves[player] + 1 : 0;
+            if (low_value_moves[player] >= adjudication.resign_moves) {
+                if (!adjudication.no_resign) {
+                    self_play_result.resigned_player = player;
+                    break;
+                }
+                if (self_play_result.would_resign_player < 0) {
+                    self_play_result.would_resign_player = player;
+                }
+            }
+        }
+        if (adjudication.draw_moves > 0) {
+            bool quiet = std::all_of(value.begin(), value.end(), [&adjudication](float v) {
+                return std::abs(v) < adjudication.draw_threshold;
+            });
+            quiet_moves = quiet ? quiet_moves + 1 : 0;
+            if (quiet_moves >= adjudication.draw_moves) {
+                self_play_result.adjudicated_draw = true;
+                break;
+            }
+        }
         self_play_result.add_state(game.get_state(), state_action_value);
         try {
             auto image = game.get_image(&state_action_value);
@@ -74,11 +147,20 @@ mcts_model_self_play(TGame game, F state_action_value_func, int mcts_steps, int
         if (turns) {
             (*turns)++;
         }
+        if (on_turn) {
+            on_turn(game, self_play_result);
+        }
 //        std::cout << "turn " << turn << std::endl;
     }
     self_play_result.add_state(game.get_state(),
                                state_action_value);  // reuse last state_action_value. might be suboptimal
     self_play_result.self_play_reward = game.get_reward();
+    if (self_play_result.resigned_player >= 0) {
+        self_play_result.self_play_reward = resignation_reward((int) self_play_result.self_play_reward.size(),
+                                                               self_play_result.resigned_player);
+    } else if (self_play_result.adjudicated_draw) {
+        std::fill(self_play_result.self_play_reward.begin(), self_play_result.self_play_reward.end(), 0.f);
+    }
     return self_play_result;
 }
 
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <torch/torch.h>
+#include "self_play.h"
+#include "train.h"
+
+
+// A game interrupted mid-play: the position to continue from and the record of the moves played so far
+struct GameInProgress {
+    torch::Tensor state;
+    int turn{0};
+    SelfPlayResult history;
+};
+
+// bumped with SELFPLAY_FILE_VERSION 4, since the recorded action codes changed meaning
+const int32_t SELFPLAY_CHECKPOINT_MAGIC = 0x53504332;
+
+// State of a self-play cycle: how many of its games are finished and persisted, and the games still being played.
+// save() writes a temporary file and renames it, so an interrupted save leaves the previous checkpoint intact.
+struct SelfPlayCheckpoint {
+    int games_completed{0};
+    std::vector<GameInProgress> games;
+
+    static void write_floats(std::ostream &os, const std::vector<float> &v) {
+        int32_t size = (int32_t) v.size();
+        os.write((char *) &size, 4);
+        os.write((char *) v.data(), sizeof(float) * size);
+    }
+
+    static std::vector<float> read_floats(std::istream &is) {
+        int32_t size;
+        is.read((char *) &size, 4);
+        std::vector<float> v(size);
+        is.read((char *) v.data(), sizeof(float) * size);
+        return v;
+    }
+
+    void save(const std::string &file_name) const {
+        std::string tmp_name = file_name + ".tmp";
+        {
+            std::ofstream f(tmp_name, std::ios::out | std::ios::binary);
+            int32_t header[3] = {SELFPLAY_CHECKPOINT_MAGIC, games_completed, (int32_t) games.size()};
+            f.write((char *) header, sizeof(header));
+            for (auto &game : games) {
+                auto &h = game.history;
+                int32_t game_header[3] = {game.turn, h.model_version, (int32_t) h.states.size()};
+                f.write((char *) game_header, sizeof(game_header));
+                SelfPlayDataset::save_tensor(game.state, f);
+                for (size_t i = 0; i < h.states.size(); ++i) {
+                    SelfPlayDataset::save_tensor(h.states[i], f);
+                    auto &sav = h.state_action_values[i];
+                    write_floats(f, sav.state_value);
+                    int32_t actions = (int32_t) sav.action_proba.size();
+                    f.write((char *) &actions, 4);
+                    for (auto &kv : sav.action_proba) {
+                        int32_t action = kv.first;
+                        f.write((char *) &action, 4);
+                        f.write((char *) &kv.second, sizeof(float));
+                    }
+                }
+            }
+            if (!f) {
+                throw std::runtime_error("failed to write self-play checkpoint " + tmp_name);
+            }
+        }
+        std::filesystem::rename(tmp_name, file_name);
+    }
+
+    // returns false when there is no checkpoint
+    bool load(const std::string &file_name) {
+        std::ifstream f(file_name, std::ios::in | std::ios::binary);
+        if (!f) {
+            return false;
+        }
+        int32_t header[3];
+        f.read((char *) header, sizeof(header));
+        if (!f || header[0] != SELFPLAY_CHECKPOINT_MAGIC) {
+            throw std::runtime_error("not a self-play checkpoint of this version: " + file_name);
+        }
+        games_completed = header[1];
+        games.clear();
+        games.resize(header[2]);
+        for (auto &game : games) {
+            int32_t game_header[3];
+            f.read((char *) game_header, sizeof(game_header));
+            game.turn = game_header[0];
+            game.history.model_version = game_header[1];
+            game.state = SelfPlayDataset::load_tensor(f);
+            for (int i = 0; i < game_header[2]; ++i) {
+                auto state = SelfPlayDataset::load_tensor(f);
+                MCTSStateActionValue sav;
+                sav.state_value = read_floats(f);
+                int32_t actions;
+                f.read((char *) &actions, 4);
+                for (int a = 0; a < actions; ++a) {
+                    int32_t action;
+                    float proba;
+                    f.read((char *) &action, 4);
+                    f.read((char *) &proba, sizeof(float));
+                    sav.action_proba[action] = proba;
+                }
+                game.history.add_state(state, sav);
+            }
+        }
+        if (!f) {
+            throw std::runtime_error("truncated self-play checkpoint " + file_name);
+        }
+        return true;
+    }
+};
+
+
+// Registry of the games being played, kept up to date move by move so that a checkpoint can be taken at any time
+class SelfPlayProgress {
+    std::mutex mutex;
+    std::unordered_map<int, GameInProgress> games;
+    int next_id{0};
+
+public:
+    // registers a game starting from, or resuming at, initial; returns its id
+    int start(GameInProgress initial) {
+        std::lock_guard<std::mutex> lock(mutex);
+        games[next_id] = std::move(initial);
+        return next_id++;
+    }
+
+    // records the move just played: record is the game record including it, state and turn the new position
+    void update(int id, const torch::Tensor &state, int turn, const SelfPlayResult &record, int model_version) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &game = games.at(id);
+        game.state = state;
+        game.turn = turn;
+        game.history.model_version = model_version;
+        game.history.add_state(record.states.back(), record.state_action_values.back());
+    }
+
+    void finish(int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        games.erase(id);
+    }
+
+    std::vector<GameInProgress> snapshot() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<GameInProgress> result;
+        for (auto &kv : games) {
+            result.push_back(kv.second);
+        }
+        return result;
+    }
+};
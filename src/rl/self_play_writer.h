@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "self_play.h"
+#include "train.h"
+#include "../util/blocking_queue.h"
+#include "../../third_party/queue/lightweightsemaphore.h"
+
+
+// Persists finished self-play games from a background thread. Games are grouped into selfplay files of batch_games
+// games and released as soon as their file is written, so producers only pay for a queue push. Shuffling, batching and
+// serialization all happen on the writer thread.
+// With a queue_capacity, at most that many games wait in the queue: add() blocks when it is full, so a disk that
+// cannot keep up slows the games down instead of growing memory without bound.
+class SelfPlayWriter {
+    BlockingQueue<SelfPlayResult> games;
+    // free queue slots, null when the queue is unbounded
+    std::unique_ptr<moodycamel::LightweightSemaphore> slots;
+    std::string dir;
+    int batch_games;
+    int batch_size;
+    float sampling;
+    std::atomic<bool> closing{false};
+    std::atomic<long> added{0};
+    std::atomic<long> written{0};
+    std::mutex flush_mutex;
+    std::condition_variable flushed;
+    std::atomic<bool> flush_requested{false};
+    // started last, once every member it uses is initialized
+    std::thread thread;
+
+    void write(std::vector<SelfPlayResult> &pending) {
+        if (!pending.empty()) {
+            SelfPlayDataset ds(pending, batch_size, true, torch::kCPU, sampling);
+            ds.save_to_dir(dir);
+            std::cout << "Persisted " << pending.size() << " games, " << written + (long) pending.size()
+                      << " in total" << std::endl;
+        }
+        {
+            std::lock_guard<std::mutex> lock(flush_mutex);
+            written += (long) pending.size();
+        }
+        flushed.notify_all();
+        pending.clear();
+    }
+
+    void run() {
+        std::vector<SelfPlayResult> pending;
+        SelfPlayResult game;
+        while (true) {
+            if (games.wait_dequeue(game, 100000)) {
+                if (slots) {
+                    slots->signal();
+                }
+                pending.push_back(std::move(game));
+                if (pending.size() >= batch_games) {
+                    write(pending);
+                }
+            } else if (closing) {
+                break;
+            }
+            if (flush_requested && games.size_approx() == 0) {
+                flush_requested = false;
+                write(pending);
+            }
+        }
+        write(pending);
+    }
+
+public:
+    // batch_size and sampling are passed on to SelfPlayDataset; a queue_capacity of 0 leaves the queue unbounded
+    SelfPlayWriter(std::string dir, int batch_games, int batch_size, float sampling, int queue_capacity = 0) :
+            slots(queue_capacity > 0 ? new moodycamel::LightweightSemaphore(queue_capacity) : nullptr),
+            dir(std::move(dir)),
+            batch_games(std::max(1, batch_games)),
+            batch_size(batch_size),
+            sampling(sampling),
+            thread(&SelfPlayWriter::run, this) {
+    }
+
+    ~SelfPlayWriter() {
+        close();
+    }
+
+    long games_written() const {
+        return written;
+    }
+
+    long games_queued() const {
+        return added - written;
+    }
+
+    // blocks while the queue is full
+    void add(SelfPlayResult &&game) {
+        if (slots) {
+            slots->wait();
+        }
+        added++;
+        games.enqueue(std::move(game));
+    }
+
+    // writes every game added so far, even if that leaves a selfplay file with less than batch_games games, and
+    // returns once they are on disk
+    void flush() {
+        long target = added;
+        std::unique_lock<std::mutex> lock(flush_mutex);
+        while (written < target) {
+            flush_requested = true;
+            flushed.wait_for(lock, std::chrono::milliseconds(100));
+        }
+    }
+
+    // writes every game added so far and stops the writer thread
+    void close() {
+        closing = true;
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+};
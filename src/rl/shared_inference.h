@@ -0,0 +1,418 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <torch/torch.h>
+#include "inference_server.h"
+
+
+// Transport between self-play processes and an inference server process on the same host. The server owns a POSIX
+// shared memory region made of a header and request slots. A client claims a free slot, writes the state into it and
+// rings the doorbell; the server forwards the slot to its InferenceServer queue, so requests from every process share
+// the same batches, and writes value and policy back into the slot before signalling it.
+// Either side may die at any point: clients give up on a server whose process is gone or whose heartbeat stopped, and
+// the server frees the slots left behind by dead clients.
+
+const uint32_t SHARED_INFERENCE_MAGIC = 0x4a434b32;
+
+const int SHARED_SLOT_FREE = 0;
+// taken by a client that is writing its state
+const int SHARED_SLOT_CLAIMED = 1;
+// ready to be picked up by the server
+const int SHARED_SLOT_REQUESTED = 2;
+// queued on the inference server; done is signalled once the reply is written
+const int SHARED_SLOT_IN_FLIGHT = 3;
+
+// state, value and policy floats of a slot start at this offset
+const size_t SHARED_SLOT_DATA_OFFSET = 64;
+
+// how long a client waits for a slot or a reply before it checks that the server is still alive
+const long SHARED_INFERENCE_POLL_US = 100000;
+// a server whose heartbeat is older than this is considered hung
+const int64_t SHARED_INFERENCE_HEARTBEAT_TIMEOUT_MS = 10000;
+// how often the server looks for slots of dead clients
+const int64_t SHARED_INFERENCE_SWEEP_MS = 1000;
+
+inline int64_t shared_inference_clock_ms() {
+    // steady_clock is CLOCK_MONOTONIC, which every process on the host shares
+    return inference_clock_us() / 1000;
+}
+
+// false only when no process with this pid exists
+inline bool process_alive(int pid) {
+    return pid > 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+struct SharedInferenceHeader {
+    // written last by the server, once the slots are initialized
+    std::atomic<uint32_t> magic{0};
+    int slots{0};
+    int state_dims{0};
+    int64_t state_shape[4]{};
+    int state_size{0};
+    int value_capacity{0};
+    int policy_capacity{0};
+    size_t slot_stride{0};
+    // bumped by clients after publishing a request; the server sleeps on it while server_sleeping is set
+    std::atomic<int> doorbell{0};
+    std::atomic<int> server_sleeping{0};
+    // where clients start looking for a free slot
+    std::atomic<int> next_slot{0};
+    // version of the model being served, bumped by the server after every hot reload
+    std::atomic<int> model_version{0};
+    int server_pid{0};
+    // shared_inference_clock_ms() of the last intake loop iteration of the server
+    std::atomic<int64_t> heartbeat_ms{0};
+};
+
+struct SharedInferenceSlot {
+    std::atomic<int> state{SHARED_SLOT_FREE};
+    int priority{0};
+    int value_size{0};
+    int policy_size{0};
+    int model_version{0};
+    // process of the client using the slot, 0 once it is free again
+    std::atomic<int> owner_pid{0};
+    CompletionFlag done{true};
+
+    // float state[state_size], value[value_capacity], policy[policy_capacity]
+    float *data() {
+        return reinterpret_cast<float *>(reinterpret_cast<char *>(this) + SHARED_SLOT_DATA_OFFSET);
+    }
+};
+
+static_assert(sizeof(SharedInferenceSlot) <= SHARED_SLOT_DATA_OFFSET, "slot header overlaps its data");
+
+// shared memory name of the inference server serving dir
+inline std::string shared_inference_name(const std::string &dir) {
+    auto path = std::filesystem::weakly_canonical(std::filesystem::absolute(dir)).string();
+    return "/jackal_inference_" + std::to_string(std::hash<std::string>()(path));
+}
+
+
+// Mapping of the shared memory region. The side that created it unlinks the name when done.
+class SharedInferenceRegion {
+    std::string name;
+    char *base{nullptr};
+    size_t size{0};
+    bool owner{false};
+
+    SharedInferenceRegion(std::string name, int fd, size_t size, bool owner) :
+            name(std::move(name)), size(size), owner(owner) {
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) {
+            if (owner) {
+                shm_unlink(this->name.c_str());
+            }
+            throw std::runtime_error("failed to map shared memory " + this->name);
+        }
+        base = static_cast<char *>(p);
+    }
+
+public:
+    // creates the region for slots requests on states of state_shape, replacing a region left behind by a crashed
+    // server with the same name
+    static std::unique_ptr<SharedInferenceRegion>
+    create(const std::string &name, int slots, c10::IntArrayRef state_shape, int value_capacity, int policy_capacity) {
+        if (state_shape.size() > 4) {
+            throw std::runtime_error("shared inference supports states of up to 4 dimensions");
+        }
+        int64_t state_size = 1;
+        for (auto d : state_shape) {
+            state_size *= d;
+        }
+        size_t data_size = sizeof(float) * (state_size + value_capacity + policy_capacity);
+        // keep every slot on its own cache lines
+        size_t slot_stride = (SHARED_SLOT_DATA_OFFSET + data_size + 63) / 64 * 64;
+        size_t header_size = (sizeof(SharedInferenceHeader) + 63) / 64 * 64;
+        size_t size = header_size + slot_stride * slots;
+
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 || ftruncate(fd, (off_t) size) != 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            throw std::runtime_error("failed to create shared memory " + name);
+        }
+        std::unique_ptr<SharedInferenceRegion> region(new SharedInferenceRegion(name, fd, size, true));
+        auto *header = new(region->base) SharedInferenceHeader();
+        header->slots = slots;
+        header->state_dims = (int) state_shape.size();
+        std::copy(state_shape.begin(), state_shape.end(), header->state_shape);
+        header->state_size = (int) state_size;
+        header->value_capacity = value_capacity;
+        header->policy_capacity = policy_capacity;
+        header->slot_stride = slot_stride;
+        header->server_pid = getpid();
+        header->heartbeat_ms = shared_inference_clock_ms();
+        for (int i = 0; i < slots; ++i) {
+            new(region->base + header_size + slot_stride * i) SharedInferenceSlot();
+        }
+        header->magic.store(SHARED_INFERENCE_MAGIC, std::memory_order_release);
+        return region;
+    }
+
+    static std::unique_ptr<SharedInferenceRegion> open(const std::string &name) {
+        int fd = shm_open(name.c_str(), O_RDWR, 0600);
+        struct stat st{};
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(SharedInferenceHeader)) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            throw std::runtime_error("no inference server found at shared memory " + name);
+        }
+        std::unique_ptr<SharedInferenceRegion> region(new SharedInferenceRegion(name, fd, st.st_size, false));
+        if (region->header().magic.load(std::memory_order_acquire) != SHARED_INFERENCE_MAGIC) {
+            throw std::runtime_error("inference server at shared memory " + name + " is not ready");
+        }
+        return region;
+    }
+
+    SharedInferenceRegion(const SharedInferenceRegion &) = delete;
+
+    SharedInferenceRegion &operator=(const SharedInferenceRegion &) = delete;
+
+    ~SharedInferenceRegion() {
+        munmap(base, size);
+        if (owner) {
+            shm_unlink(name.c_str());
+        }
+    }
+
+    SharedInferenceHeader &header() {
+        return *reinterpret_cast<SharedInferenceHeader *>(base);
+    }
+
+    SharedInferenceSlot &slot(int i) {
+        size_t header_size = (sizeof(SharedInferenceHeader) + 63) / 64 * 64;
+        return *reinterpret_cast<SharedInferenceSlot *>(base + header_size + header().slot_stride * i);
+    }
+
+    const std::string &get_name() const {
+        return name;
+    }
+};
+
+
+// Client side, used by self-play processes instead of an in-process InferenceServer
+class SharedInferenceClient : public InferenceClient {
+    std::unique_ptr<SharedInferenceRegion> region;
+
+    void check_server() {
+        auto &header = region->header();
+        if (!process_alive(header.server_pid)) {
+            throw std::runtime_error("inference server process " + std::to_string(header.server_pid) + " is gone");
+        }
+        if (shared_inference_clock_ms() - header.heartbeat_ms > SHARED_INFERENCE_HEARTBEAT_TIMEOUT_MS) {
+            throw std::runtime_error("inference server process " + std::to_string(header.server_pid) +
+                                     " stopped responding");
+        }
+    }
+
+    SharedInferenceSlot &claim() {
+        auto &header = region->header();
+        int64_t next_check = inference_clock_us() + SHARED_INFERENCE_POLL_US;
+        while (true) {
+            for (int n = 0; n < header.slots; ++n) {
+                int i = (header.next_slot.fetch_add(1, std::memory_order_relaxed) & INT_MAX) % header.slots;
+                auto &slot = region->slot(i);
+                int expected = SHARED_SLOT_FREE;
+                if (slot.state.load(std::memory_order_relaxed) == SHARED_SLOT_FREE &&
+                    slot.state.compare_exchange_strong(expected, SHARED_SLOT_CLAIMED, std::memory_order_acquire)) {
+                    slot.owner_pid.store(getpid(), std::memory_order_relaxed);
+                    return slot;
+                }
+            }
+            if (inference_clock_us() > next_check) {
+                check_server();
+                next_check = inference_clock_us() + SHARED_INFERENCE_POLL_US;
+            }
+            // every slot is in use, let the requests in flight complete
+            if (Fiber::current()) {
+                Fiber::yield();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+public:
+    explicit SharedInferenceClient(const std::string &name) : region(SharedInferenceRegion::open(name)) {
+    }
+
+    // version of the model the server is currently serving
+    int model_version() const {
+        return region->header().model_version;
+    }
+
+    // throws when the server dies or hangs before replying
+    void request(torch::Tensor &state, InferenceReply &reply, int priority) override {
+        auto &header = region->header();
+        auto x = state.to(torch::kCPU, torch::kFloat).contiguous();
+        if (x.numel() != header.state_size) {
+            throw std::runtime_error("state size does not match the shared inference server");
+        }
+        auto &slot = claim();
+        float *data = slot.data();
+        std::copy_n(x.data_ptr<float>(), header.state_size, data);
+        slot.priority = priority;
+        slot.done.reset();
+        slot.state.store(SHARED_SLOT_REQUESTED, std::memory_order_release);
+        header.doorbell.fetch_add(1);
+        if (header.server_sleeping.exchange(0)) {
+            futex_wake(&header.doorbell, true);
+        }
+        while (!Fiber::await_for(slot.done, SHARED_INFERENCE_POLL_US)) {
+            check_server();
+        }
+
+        float *value = data + header.state_size;
+        float *policy = value + header.value_capacity;
+        reply.value.assign(value, value + slot.value_size);
+        reply.policy.assign(policy, policy + slot.policy_size);
+        reply.has_policy = slot.policy_size > 0;
+        reply.model_version = slot.model_version;
+        slot.owner_pid.store(0, std::memory_order_relaxed);
+        slot.state.store(SHARED_SLOT_FREE, std::memory_order_release);
+    }
+};
+
+
+// Server side: forwards the requested slots to an in-process InferenceServer queue and writes the replies back. An
+// intake thread scans the slots whenever the doorbell rings, a reply thread copies results into the slots in the order
+// the inference server finishes them, so a reply never waits behind an older request still queued at a lower priority.
+// The intake thread also keeps the heartbeat of the header current and frees the slots of clients that died.
+// The region has to be created with value and policy capacities that fit the replies of the model.
+class SharedInferenceBridge {
+    SharedInferenceRegion &region;
+    TModelQueue &queue;
+    // views of the slot states, read by the inference server in place
+    std::vector<torch::Tensor> states;
+    std::vector<std::unique_ptr<InferenceReply>> replies;
+    // replies finished by the inference server, tagged with their slot
+    BlockingQueue<InferenceReply *> completions;
+    // forwarded slots whose reply has not been written yet
+    std::atomic<int> in_flight{0};
+
+    int forward_requests() {
+        auto &header = region.header();
+        int forwarded = 0;
+        for (int i = 0; i < header.slots; ++i) {
+            auto &slot = region.slot(i);
+            int expected = SHARED_SLOT_REQUESTED;
+            if (slot.state.load(std::memory_order_relaxed) == SHARED_SLOT_REQUESTED &&
+                slot.state.compare_exchange_strong(expected, SHARED_SLOT_IN_FLIGHT, std::memory_order_acquire)) {
+                in_flight++;
+                queue.enqueue(TModelJob{&states[i], replies[i].get(), inference_clock_us()}, slot.priority);
+                forwarded++;
+            }
+        }
+        return forwarded;
+    }
+
+    // Frees the slots of clients whose process is gone. Runs on the intake thread, so a requested slot can not be
+    // forwarded meanwhile; a slot still queued on the inference server is left to a later sweep, once its reply is
+    // written.
+    void reclaim_abandoned_slots() {
+        auto &header = region.header();
+        for (int i = 0; i < header.slots; ++i) {
+            auto &slot = region.slot(i);
+            int owner = slot.owner_pid.load(std::memory_order_relaxed);
+            if (owner == 0 || process_alive(owner)) {
+                continue;
+            }
+            int state = slot.state.load(std::memory_order_acquire);
+            if (state == SHARED_SLOT_CLAIMED || state == SHARED_SLOT_REQUESTED ||
+                (state == SHARED_SLOT_IN_FLIGHT && slot.done.is_set())) {
+                slot.owner_pid.store(0, std::memory_order_relaxed);
+                slot.state.store(SHARED_SLOT_FREE, std::memory_order_release);
+            }
+        }
+    }
+
+    void write_reply(InferenceReply &reply) {
+        auto &header = region.header();
+        auto &slot = region.slot(reply.tag);
+        float *value = slot.data() + header.state_size;
+        // the capacities are checked against the model at startup, this only keeps other slots safe
+        slot.value_size = std::min((int) reply.value.size(), header.value_capacity);
+        slot.policy_size = reply.has_policy ? std::min((int) reply.policy.size(), header.policy_capacity) : 0;
+        std::copy_n(reply.value.begin(), slot.value_size, value);
+        slot.model_version = reply.model_version;
+        std::copy_n(reply.policy.begin(), slot.policy_size, value + header.value_capacity);
+        in_flight--;
+        slot.done.signal();
+    }
+
+    void reply_loop(std::atomic<bool> *terminated) {
+        InferenceReply *reply;
+        while (!*terminated) {
+            if (completions.wait_dequeue(reply, INFERENCE_IDLE_WAIT_US)) {
+                write_reply(*reply);
+            }
+        }
+        // answer what is already forwarded, the inference server is still running
+        while (in_flight > 0) {
+            if (completions.wait_dequeue(reply, INFERENCE_IDLE_WAIT_US)) {
+                write_reply(*reply);
+            }
+        }
+    }
+
+public:
+    SharedInferenceBridge(SharedInferenceRegion &region, TModelQueue &queue) : region(region), queue(queue) {
+        auto &header = region.header();
+        std::vector<int64_t> shape(header.state_shape, header.state_shape + header.state_dims);
+        for (int i = 0; i < header.slots; ++i) {
+            states.push_back(torch::from_blob(region.slot(i).data(), shape, torch::kFloat));
+            replies.emplace_back(new InferenceReply());
+            replies.back()->completions = &completions;
+            replies.back()->tag = i;
+        }
+    }
+
+    // serves the slots until terminated is set; the InferenceServer has to be stopped after this returns
+    void run(std::atomic<bool> *terminated) {
+        auto &header = region.header();
+        std::thread reply_thread(&SharedInferenceBridge::reply_loop, this, terminated);
+        int64_t next_sweep = shared_inference_clock_ms() + SHARED_INFERENCE_SWEEP_MS;
+        while (!*terminated) {
+            int64_t now = shared_inference_clock_ms();
+            // written only when it changes, clients ring the doorbell on the same cache line
+            if (header.heartbeat_ms.load(std::memory_order_relaxed) != now) {
+                header.heartbeat_ms.store(now, std::memory_order_relaxed);
+            }
+            if (now >= next_sweep) {
+                reclaim_abandoned_slots();
+                next_sweep = now + SHARED_INFERENCE_SWEEP_MS;
+            }
+            if (forward_requests() > 0) {
+                continue;
+            }
+            header.server_sleeping.store(1);
+            int doorbell = header.doorbell.load();
+            if (forward_requests() > 0) {
+                continue;
+            }
+            futex_wait(&header.doorbell, doorbell, true, INFERENCE_IDLE_WAIT_US);
+        }
+        reply_thread.join();
+    }
+};
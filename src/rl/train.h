@@ -2,23 +2,88 @@
 
 #include "self_play.h"
 #include "../util/utils.h"
+#include "../util/mapped_file.h"
+#include "plane_packing.h"
+#include "replay_buffer.h"
+#include "../util/blocking_queue.h"
+#include "../../third_party/queue/lightweightsemaphore.h"
 #include "../../third_party/tb_logger/include/tensorboard_logger.h"
 #include <experimental/filesystem>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <exception>
+#include <mutex>
+#include <memory>
+#include <random>
+#include <set>
+#include <thread>
 #include <utility>
 #include <filesystem>
+#include <unistd.h>
 
 
 inline std::vector<std::string> get_selfplay_files(const std::string &dir) {
     std::vector<std::string> selfplays;
     for (auto &p: std::filesystem::directory_iterator(dir)) {
-        std::string s = p.path();
-        if (s.find("selfplay") != std::string::npos) {
-            selfplays.push_back(s);
+        if (p.path().filename().string().rfind("selfplay", 0) == 0) {
+            selfplays.push_back(p.path());
         }
     }
     return selfplays;
 }
 
+// Sort key of a selfplay file: the creation time in milliseconds of a dir/selfplay_<ms>_<pid>_<seq>.bin file, N of
+// an older dir/selfplay_N.bin file, which sorts before every timestamped one, and -1 for other names
+inline int64_t selfplay_file_number(const std::string &path) {
+    auto name = std::filesystem::path(path).filename().string();
+    const std::string prefix = "selfplay_";
+    if (name.rfind(prefix, 0) != 0) {
+        return -1;
+    }
+    try {
+        return std::stoll(name.substr(prefix.size()));
+    } catch (const std::exception &) {
+        return -1;
+    }
+}
+
+// selfplay files start with -SELFPLAY_FILE_VERSION and are columnar, see SelfPlayFileHeader. Older files are rejected:
+// version 4 came with the wraparound Jackal::encode_action, so the action codes of earlier files (columnar version 3,
+// torch::save'd tensors in versions 1 and 2) no longer mean the same moves.
+const int32_t SELFPLAY_FILE_VERSION = 4;
+
+// storage types of the state planes in a columnar selfplay file
+const int32_t SELFPLAY_PLANES_FLOAT = 0;
+const int32_t SELFPLAY_PLANES_INT8 = 1;
+// PlanePacking rows, with the width of every plane in the state_shape[0] bytes following the header
+const int32_t SELFPLAY_PLANES_PACKED = 2;
+
+// columns start at multiples of SELFPLAY_COLUMN_ALIGNMENT bytes
+const int64_t SELFPLAY_COLUMN_ALIGNMENT = 64;
+
+// Header of a columnar selfplay file. The rows of all batches are stored one column after the other, each a flat array
+// of fixed-width records: the state planes (packed when every value is a small integer, float otherwise), the
+// action target (int64), the state value targets (value_size floats) and the model version (int32). batch_offset
+// points to batches + 1 int64 row indices delimiting the batches. Offsets are in bytes from the start of the file.
+struct SelfPlayFileHeader {
+    int32_t version;
+    int32_t batches;
+    int64_t rows;
+    int32_t plane_type;
+    int32_t value_size;
+    int32_t state_dims;
+    int32_t reserved;
+    // shape of the state of one row, without the batch dimension
+    int64_t state_shape[4];
+    int64_t batch_offset;
+    int64_t x_offset;
+    int64_t action_offset;
+    int64_t value_offset;
+    int64_t model_version_offset;
+    int64_t file_size;
+};
+
 class SelfPlayDataset {
     torch::Device device;
 public:
@@ -27,6 +92,8 @@ public:
         torch::Tensor x;
         torch::Tensor action_proba;
         torch::Tensor state_value;
+        // SelfPlayResult::model_version of every row, int32
+        torch::Tensor model_version;
     };
 
 
@@ -41,7 +108,8 @@ public:
                 items.push_back(Example{
                         self_play.states[i],
                         torch::tensor({self_play.state_action_values[i].best_action()}),
-                        self_play.reward_to_tensor()
+                        self_play.reward_to_tensor(),
+                        torch::tensor({self_play.model_version}, torch::kInt32)
                 });
             }
 
@@ -55,15 +123,18 @@ public:
             std::vector<torch::Tensor> x;
             std::vector<torch::Tensor> action_proba;
             std::vector<torch::Tensor> state_value;
+            std::vector<torch::Tensor> model_version;
             for (int i = batch_idx; i < std::min((int) items.size(), batch_idx + batch_size); ++i) {
                 x.push_back(items[i].x);
                 action_proba.push_back(items[i].action_proba);
                 state_value.push_back(items[i].state_value);
+                model_version.push_back(items[i].model_version);
             }
             examples.push_back(Example{
                     torch::cat({&x[0], x.size()}).to(device),
                     torch::cat({&action_proba[0], action_proba.size()}).to(device),
-                    torch::stack({&state_value[0], state_value.size()}).to(device)
+                    torch::stack({&state_value[0], state_value.size()}).to(device),
+                    torch::cat({&model_version[0], model_version.size()})
             });
         }
     };
@@ -81,7 +152,7 @@ public:
 
     std::vector<Example> examples;
 
-    void save_tensor(torch::Tensor &t, std::ostream &os) {
+    static void save_tensor(const torch::Tensor &t, std::ostream &os) {
         std::ostringstream o(std::ios::out | std::ios::binary);
         torch::save(t, o);
         int32_t sz = o.str().size();
@@ -89,7 +160,7 @@ public:
         os.write(o.str().c_str(), sz);
     }
 
-    torch::Tensor load_tensor(std::istream &is) {
+    static torch::Tensor load_tensor(std::istream &is) {
         int32_t sz;
         is.read((char *) &sz, 4);
         std::unique_ptr<char[]> buf(new char[sz]);
@@ -101,40 +172,197 @@ public:
     }
 
 
+    // Several self-play processes may write to the same dir, so file names carry the creation time, the pid and a
+    // per-process sequence number. The file is written under a temporary name that get_selfplay_files() ignores and
+    // renamed into place once complete, so readers never map a partly written file.
     void save_to_dir(const std::string &dir) {
-        auto selfplay_files = get_selfplay_files(dir);
-        const std::string &selfplay_file = dir + "/selfplay_" + std::to_string(selfplay_files.size()) + ".bin";
-        save(selfplay_file);
+        static std::atomic<int> sequence{0};
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        std::string id = std::to_string(ms) + "_" + std::to_string(getpid()) + "_" + std::to_string(sequence++);
+        std::string tmp_file = dir + "/.writing_" + id;
+        save(tmp_file);
+        std::filesystem::rename(tmp_file, dir + "/selfplay_" + id + ".bin");
+    }
+
+    static int64_t align_column(int64_t offset) {
+        return (offset + SELFPLAY_COLUMN_ALIGNMENT - 1) / SELFPLAY_COLUMN_ALIGNMENT * SELFPLAY_COLUMN_ALIGNMENT;
+    }
+
+    // writes t at offset, zero-padding the file up to it; columns are written in file order
+    static void write_column(std::ostream &os, int64_t offset, const torch::Tensor &t) {
+        static const char zeros[SELFPLAY_COLUMN_ALIGNMENT] = {};
+        for (int64_t pos = os.tellp(); pos < offset; pos = os.tellp()) {
+            os.write(zeros, (std::streamsize) std::min<int64_t>(offset - pos, SELFPLAY_COLUMN_ALIGNMENT));
+        }
+        if (t.defined()) {
+            auto c = t.contiguous();
+            os.write((const char *) c.data_ptr(), (std::streamsize) c.nbytes());
+        }
     }
 
     void save(const std::string &fname) {
-        std::ofstream f(fname, std::ios::out | std::ios::binary);
-        int32_t size = examples.size();
-        f.write((char *) &size, 4);
+        SelfPlayFileHeader header{};
+        header.version = -SELFPLAY_FILE_VERSION;
+        header.batches = (int32_t) examples.size();
+        header.plane_type = examples.empty() ? SELFPLAY_PLANES_FLOAT : SELFPLAY_PLANES_PACKED;
+        std::vector<torch::Tensor> float_x;
         for (auto &ex: examples) {
-            save_tensor(ex.x, f);
-            save_tensor(ex.action_proba, f);
-            save_tensor(ex.state_value, f);
+            header.rows += ex.x.size(0);
+            float_x.push_back(ex.x.to(torch::kCPU, torch::kFloat32).contiguous());
+        }
+        int64_t row_planes = 0;
+        PlanePacking packing;
+        if (!examples.empty()) {
+            auto &first = examples[0];
+            if (first.x.dim() - 1 > 4) {
+                throw std::runtime_error("selfplay files support states of up to 4 dimensions");
+            }
+            header.state_dims = (int32_t) first.x.dim() - 1;
+            row_planes = 1;
+            for (int d = 0; d < header.state_dims; ++d) {
+                header.state_shape[d] = first.x.size(d + 1);
+                row_planes *= header.state_shape[d];
+            }
+            header.value_size = (int32_t) (first.state_value.numel() / std::max<int64_t>(1, first.x.size(0)));
+            int64_t planes = header.state_dims > 0 ? header.state_shape[0] : 1;
+            std::vector<int8_t> bits(planes, PLANE_BITS_BINARY);
+            for (auto &x: float_x) {
+                auto fit = PlanePacking::fit(x.data_ptr<float>(), x.size(0), planes, row_planes / planes);
+                if (fit.empty()) {
+                    header.plane_type = SELFPLAY_PLANES_FLOAT;
+                    break;
+                }
+                for (int64_t p = 0; p < planes; ++p) {
+                    bits[p] = std::max(bits[p], fit[p]);
+                }
+            }
+            if (header.plane_type == SELFPLAY_PLANES_PACKED) {
+                packing = PlanePacking(bits, row_planes / planes);
+            }
+        }
+        int64_t row_bytes = header.plane_type == SELFPLAY_PLANES_PACKED ? packing.row_bytes() : row_planes * 4;
+        header.batch_offset = align_column(sizeof(header) + packing.plane_bits().size());
+        header.x_offset = align_column(header.batch_offset + 8 * (header.batches + 1));
+        header.action_offset = align_column(header.x_offset + header.rows * row_bytes);
+        header.value_offset = align_column(header.action_offset + header.rows * 8);
+        header.model_version_offset = align_column(header.value_offset + header.rows * header.value_size * 4);
+        header.file_size = header.model_version_offset + header.rows * 4;
+
+        std::vector<int64_t> batch_rows{0};
+        std::vector<torch::Tensor> x, action, value, model_version;
+        for (auto &ex: examples) {
+            batch_rows.push_back(batch_rows.back() + ex.x.size(0));
+            auto &fx = float_x[x.size()];
+            if (header.plane_type == SELFPLAY_PLANES_PACKED) {
+                auto packed = torch::empty({fx.size(0), row_bytes}, torch::kUInt8);
+                packing.pack(fx.data_ptr<float>(), fx.size(0), packed.data_ptr<uint8_t>());
+                x.push_back(packed);
+            } else {
+                x.push_back(fx);
+            }
+            action.push_back(ex.action_proba.to(torch::kCPU, torch::kInt64));
+            value.push_back(ex.state_value.to(torch::kCPU, torch::kFloat32));
+            if (!ex.model_version.defined()) {
+                ex.model_version = torch::full({ex.x.size(0)}, -1, torch::kInt32);
+            }
+            model_version.push_back(ex.model_version.to(torch::kInt32));
+        }
+        std::ofstream f(fname, std::ios::out | std::ios::binary);
+        f.write((const char *) &header, sizeof(header));
+        f.write((const char *) packing.plane_bits().data(), (std::streamsize) packing.plane_bits().size());
+        write_column(f, header.batch_offset, torch::tensor(batch_rows, torch::kInt64));
+        int64_t offsets[] = {header.x_offset, header.action_offset, header.value_offset, header.model_version_offset};
+        std::vector<torch::Tensor> *columns[] = {&x, &action, &value, &model_version};
+        for (int c = 0; c < 4; ++c) {
+            write_column(f, offsets[c], torch::Tensor());
+            for (auto &t: *columns[c]) {
+                write_column(f, 0, t);
+            }
+        }
+        write_column(f, header.file_size, torch::Tensor());
+        if (!f) {
+            throw std::runtime_error("failed to write selfplay file " + fname);
         }
     }
 
-    void load(const std::string &fname, float sampling = 1.0) {
-        examples.clear();
-        std::ifstream f(fname, std::ios::in | std::ios::binary);
-        int32_t size;
-        f.read((char *) &size, 4);
-        for (int i = 0; i < size; ++i) {
+    // Columnar files are mapped rather than read: the examples wrap the mapped pages with from_blob and keep the
+    // mapping alive until the last of them is released. Packed and int8 planes are expanded to float on load.
+    void load_columnar(const std::string &fname, float sampling) {
+        auto file = std::make_shared<MappedFile>(fname);
+        if (file->size() < sizeof(SelfPlayFileHeader)) {
+            throw std::runtime_error("truncated selfplay file " + fname);
+        }
+        auto &header = *(const SelfPlayFileHeader *) file->data();
+        if (header.file_size > (int64_t) file->size() || header.state_dims > 4 || header.plane_type < 0 ||
+            header.plane_type > SELFPLAY_PLANES_PACKED) {
+            throw std::runtime_error("corrupt selfplay file " + fname);
+        }
+        auto keep = [file](void *) {};
+        auto column = [&file, &keep](int64_t offset, std::vector<int64_t> shape, torch::ScalarType type) {
+            return torch::from_blob(file->data() + offset, shape, keep, torch::TensorOptions().dtype(type));
+        };
+        auto *batch_rows = (const int64_t *) (file->data() + header.batch_offset);
+        std::vector<int64_t> state_shape(header.state_shape, header.state_shape + header.state_dims);
+        int64_t row_planes = 1;
+        for (auto d: state_shape) {
+            row_planes *= d;
+        }
+        PlanePacking packing;
+        int64_t row_bytes = row_planes * (header.plane_type == SELFPLAY_PLANES_INT8 ? 1 : 4);
+        if (header.plane_type == SELFPLAY_PLANES_PACKED) {
+            int64_t planes = header.state_dims > 0 ? header.state_shape[0] : 1;
+            auto *bits = (const int8_t *) (file->data() + sizeof(SelfPlayFileHeader));
+            packing = PlanePacking(std::vector<int8_t>(bits, bits + planes), row_planes / planes);
+            row_bytes = packing.row_bytes();
+        }
+        for (int b = 0; b < header.batches; ++b) {
             if (rand01() > sampling) {
                 continue;
             }
+            int64_t begin = batch_rows[b], rows = batch_rows[b + 1] - begin;
+            std::vector<int64_t> x_shape{rows};
+            x_shape.insert(x_shape.end(), state_shape.begin(), state_shape.end());
             Example ex;
-            ex.x = load_tensor(f).to(device);
-            ex.action_proba = load_tensor(f).to(device);
-            ex.state_value = load_tensor(f).to(device);
+            int64_t x_offset = header.x_offset + begin * row_bytes;
+            if (header.plane_type == SELFPLAY_PLANES_PACKED) {
+                ex.x = torch::empty(x_shape, torch::kFloat32);
+                packing.unpack((const uint8_t *) file->data() + x_offset, rows, ex.x.data_ptr<float>());
+            } else {
+                ex.x = column(x_offset, x_shape,
+                              header.plane_type == SELFPLAY_PLANES_INT8 ? torch::kInt8 : torch::kFloat32);
+            }
+            ex.x = ex.x.to(device, torch::kFloat32);
+            ex.action_proba = column(header.action_offset + begin * 8, {rows}, torch::kInt64).to(device);
+            ex.state_value = column(header.value_offset + begin * header.value_size * 4, {rows, header.value_size},
+                                    torch::kFloat32).to(device);
+            ex.model_version = column(header.model_version_offset + begin * 4, {rows}, torch::kInt32);
             examples.push_back(ex);
         }
     }
 
+    // header of a selfplay file, read without loading the rest of it
+    static SelfPlayFileHeader read_header(const std::string &fname) {
+        SelfPlayFileHeader header{};
+        std::ifstream f(fname, std::ios::in | std::ios::binary);
+        f.read((char *) &header, sizeof(header));
+        if (header.version != -SELFPLAY_FILE_VERSION) {
+            throw std::runtime_error("selfplay file " + fname + " is not of version " +
+                                     std::to_string(SELFPLAY_FILE_VERSION) +
+                                     "; files of earlier versions use another action encoding");
+        }
+        if (!f) {
+            throw std::runtime_error("truncated selfplay file " + fname);
+        }
+        return header;
+    }
+
+    void load(const std::string &fname, float sampling = 1.0) {
+        examples.clear();
+        read_header(fname);
+        load_columnar(fname, sampling);
+    }
+
     void load(std::vector<std::string> &fnames, float sampling = 1.0) {
         std::vector<SelfPlayDataset> dss;
         dss.resize(fnames.size(), SelfPlayDataset(device));
@@ -157,12 +385,118 @@ public:
 };
 
 
+// get_selfplay_files() without the files SelfPlayDataset::load() rejects, such as those written before the current file
+// version; every skipped file is reported
+inline std::vector<std::string> get_loadable_selfplay_files(const std::string &dir) {
+    std::vector<std::string> loadable;
+    for (auto &fname: get_selfplay_files(dir)) {
+        try {
+            SelfPlayDataset::read_header(fname);
+            loadable.push_back(fname);
+        } catch (const std::exception &e) {
+            std::cerr << "Skipping " << fname << ": " << e.what() << std::endl;
+        }
+    }
+    return loadable;
+}
+
+// Streams the batches of a list of selfplay files to the training loop. The files are visited once, in shuffled
+// order, by reader threads that load, decode and move them to the device; their batches are shuffled within the file
+// and wait in a queue of at most prefetch_batches batches, so memory holds only the files being read and the
+// prefetched batches while the optimizer never waits on the disk.
+class SelfPlayLoader {
+    typedef SelfPlayDataset::Example Example;
+
+    std::vector<std::string> files;
+    float sampling;
+    torch::Device device;
+    BlockingQueue<Example> batches;
+    moodycamel::LightweightSemaphore slots;
+    std::atomic<int> next_file{0};
+    std::atomic<int> readers_done{0};
+    std::atomic<bool> stopping{false};
+    std::mutex error_mutex;
+    std::exception_ptr error;
+    std::vector<std::thread> readers;
+
+    // waits for a free queue slot, false once the loader is stopping
+    bool reserve_slot() {
+        while (!stopping) {
+            if (slots.wait(100000)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void read(unsigned seed) {
+        // get_generator() is not shared with the reader threads
+        std::default_random_engine generator(seed);
+        try {
+            for (int i = next_file++; i < (int) files.size() && !stopping; i = next_file++) {
+                SelfPlayDataset ds(device);
+                ds.load(files[i], sampling);
+                std::shuffle(ds.examples.begin(), ds.examples.end(), generator);
+                for (auto &ex: ds.examples) {
+                    if (!reserve_slot()) {
+                        break;
+                    }
+                    batches.enqueue(std::move(ex));
+                }
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            error = std::current_exception();
+        }
+        readers_done++;
+    }
+
+public:
+    SelfPlayLoader(std::vector<std::string> files, float sampling, int threads, int prefetch_batches,
+                   torch::Device device = torch::kCPU) :
+            files(std::move(files)),
+            sampling(sampling),
+            device(device),
+            slots(std::max(1, prefetch_batches)) {
+        std::shuffle(this->files.begin(), this->files.end(), get_generator());
+        threads = std::max(1, std::min(threads, (int) this->files.size()));
+        for (int t = 0; t < threads && !this->files.empty(); ++t) {
+            readers.emplace_back(&SelfPlayLoader::read, this, (unsigned) get_generator()());
+        }
+    }
+
+    ~SelfPlayLoader() {
+        stopping = true;
+        for (auto &t: readers) {
+            t.join();
+        }
+    }
+
+    // Takes the next batch; false once every file has been read and its batches taken. Rethrows the error of a
+    // reader that failed.
+    bool next(Example &ex) {
+        while (true) {
+            if (batches.wait_dequeue(ex, 100000)) {
+                slots.signal();
+                return true;
+            }
+            if (readers_done == (int) readers.size() && batches.size_approx() == 0) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+                return false;
+            }
+        }
+    }
+};
+
 template<class TModel>
 float evaluate(TModel model, const std::string &dir, float sampling, torch::Device device = torch::kCPU) {
     model->eval();
     torch::NoGradGuard no_grad;
 
-    auto selfplay_files = get_selfplay_files(dir);
+    auto selfplay_files = get_loadable_selfplay_files(dir);
     float loss = 0.;
     int total = 0;
     for (auto selfplay_file : selfplay_files) {
@@ -228,6 +562,9 @@ public:
 
     std::unordered_map<std::string, float> config;
     torch::Device device;
+    // positions of the last train_replay_buffer positions of the training files, kept across train() calls
+    std::unique_ptr<ReplayBuffer> replay;
+    std::set<std::string> replayed_files;
 
     explicit Trainer(
             std::unordered_map<std::string, float> pconfig = {},
@@ -239,15 +576,47 @@ public:
         static std::unordered_map<std::string, float> default_config = {
                 {"train_learning_rate",         1e-3},
                 {"train_l2_regularization",     1e-4},
-                {"train_replay_buffer",         1 >> 16},
+                {"train_replay_buffer",         1 << 16},
+                {"train_replay_version_decay",  1.},
                 {"train_epochs",                10},
                 {"train_batch_size",            32},
+                {"train_loader_threads",        2},
+                {"train_prefetch_batches",      64},
 
                 {"simulation_cycles",           10},
                 {"simulation_cycle_games",      256},
                 {"simulation_temperature",      1.},
                 {"simulation_threads",          1},
                 {"simulation_max_turns",        1000},
+                {"simulation_fibers",           0},
+                {"simulation_model_reload",     0},
+                {"simulation_checkpoint_seconds", 0},
+                {"simulation_resume",           0},
+                {"simulation_writer_queue",     64},
+                {"simulation_resign_threshold", -0.9},
+                {"simulation_resign_moves",     0},
+                {"simulation_no_resign_fraction", 0.1},
+                {"simulation_draw_threshold",   0.05},
+                {"simulation_draw_moves",       0},
+                {"simulation_streaming",        0},
+                {"simulation_stream_games",     0},
+                {"simulation_stream_seconds",   0},
+
+                {"inference_max_batch_size",    256},
+                {"inference_max_wait_us",       1000},
+                {"inference_pipeline_buffers",  2},
+                {"inference_workers",           1},
+                {"inference_threads_per_worker", 0},
+                {"inference_cache_size",        1 << 18},
+                {"inference_cache_shards",      64},
+                {"inference_backend",           0},
+                {"inference_shared_memory",     0},
+                {"inference_shared_slots",      4096},
+                {"quantization_calibration_batches", 16},
+
+                {"policy_head",                 0},
+
+                {"device_cuda",                 -1},
 
                 {"mcts_iterations",             100},
                 {"mcts_iterations_first_cycle", 100},
@@ -274,6 +643,68 @@ public:
         }
     }
 
+    // Adds the training files not seen yet to the replay buffer and weighs the positions by the age of their model:
+    // train_replay_version_decay per version behind the newest one. Only the newest files that fill the buffer are
+    // read, train_loader_threads at a time, and added oldest first; older ones would be evicted right away. Files of
+    // an earlier version are skipped.
+    void update_replay(const std::string &dir) {
+        auto files = get_selfplay_files(dir);
+        std::sort(files.begin(), files.end(), [](const std::string &a, const std::string &b) {
+            return selfplay_file_number(a) > selfplay_file_number(b);
+        });
+        std::vector<std::string> pending;
+        int64_t rows = 0;
+        for (auto &fname: files) {
+            if (!replayed_files.insert(fname).second || rows >= replay->max_size()) {
+                continue;
+            }
+            try {
+                rows += SelfPlayDataset::read_header(fname).rows;
+                pending.push_back(fname);
+            } catch (const std::exception &e) {
+                // seen, so it is reported once
+                std::cerr << "Skipping " << fname << ": " << e.what() << std::endl;
+            }
+        }
+        std::reverse(pending.begin(), pending.end());
+        size_t threads = std::max(1, (int) config["train_loader_threads"]);
+        for (size_t first = 0; first < pending.size(); first += threads) {
+            size_t count = std::min(threads, pending.size() - first);
+            std::vector<SelfPlayDataset> datasets(count);
+            std::vector<std::exception_ptr> errors(count);
+            std::vector<std::thread> readers;
+            for (size_t i = 0; i < count; ++i) {
+                readers.emplace_back([&, i]() {
+                    try {
+                        datasets[i].load(pending[first + i]);
+                    } catch (...) {
+                        errors[i] = std::current_exception();
+                    }
+                });
+            }
+            for (auto &t: readers) {
+                t.join();
+            }
+            for (size_t i = 0; i < count; ++i) {
+                if (errors[i]) {
+                    std::rethrow_exception(errors[i]);
+                }
+                for (auto &ex: datasets[i].examples) {
+                    replay->add(ex.x, ex.action_proba, ex.state_value, ex.model_version);
+                }
+            }
+        }
+        float decay = config["train_replay_version_decay"];
+        if (decay < 1 && replay->size() > 0) {
+            int32_t newest = replay->newest_model_version();
+            replay->set_weights([decay, newest](int32_t version) {
+                return std::pow(decay, (float) (newest - version));
+            });
+        }
+        std::cout << "Replay buffer: " << replay->size() << " positions, " << replay->state_bytes() / 1024
+                  << " KiB of states" << (replay->is_packed() ? " packed" : "") << std::endl;
+    }
+
     float train(const std::string &dir,
                 SelfPlayDataset *eval_set,
                 int &step,
@@ -283,8 +714,9 @@ public:
         TGame game((int) config["jackal_height"], (int) config["jackal_width"], (int) config["jackal_players"]);
         auto dims = game.get_state().sizes();
 
-        TModel model(dims, channels, blocks, players, config["enable_action_value"] > 0);
-        TModel baseline_model(dims, channels, blocks, players, config["enable_action_value"] > 0);
+        TModel model(dims, channels, blocks, players, config["enable_action_value"] > 0, (int) config["policy_head"]);
+        TModel baseline_model(dims, channels, blocks, players, config["enable_action_value"] > 0,
+                              (int) config["policy_head"]);
 
         auto model_path = dir + "/model.bin";
         if (std::filesystem::exists(model_path)) {
@@ -315,16 +747,43 @@ public:
                                            device));
 
         for (int epoch = 0; epoch < int(config["train_epochs"]); ++epoch) {
-            auto selfplay_files = get_selfplay_files(dir + "/train");
+            auto selfplay_files = get_loadable_selfplay_files(dir + "/train");
             std::cout << "train_epoch: " << epoch << " train files:" << selfplay_files << std::endl;
-            SelfPlayDataset ds(device);
-            ds.load(selfplay_files, config["train_replay_sampling_rate"]);
+            // with a replay buffer an epoch samples train_replay_sampling_rate of its positions, otherwise the loader
+            // streams that fraction of the training files
+            std::unique_ptr<SelfPlayLoader> loader;
+            int64_t replay_batches = 0;
+            int batch_size = std::max(1, (int) config["train_batch_size"]);
+            if (config["train_replay_buffer"] > 0) {
+                if (!replay) {
+                    replay.reset(new ReplayBuffer((int64_t) config["train_replay_buffer"]));
+                }
+                update_replay(dir + "/train");
+                replay_batches = (int64_t) std::ceil(
+                        (float) replay->size() * config["train_replay_sampling_rate"] / (float) batch_size);
+            } else {
+                loader.reset(new SelfPlayLoader(selfplay_files, config["train_replay_sampling_rate"],
+                                                (int) config["train_loader_threads"],
+                                                (int) config["train_prefetch_batches"], device));
+            }
+            SelfPlayDataset::Example example;
+            auto next_batch = [&]() {
+                if (loader) {
+                    return loader->next(example);
+                }
+                if (replay_batches-- <= 0) {
+                    return false;
+                }
+                auto batch = replay->sample(batch_size, get_generator());
+                example = SelfPlayDataset::Example{batch.x.to(device), batch.action.to(device),
+                                                   batch.state_value.to(device), batch.model_version};
+                return true;
+            };
 
             float train_loss = 0;
             int trained_batches = 0;
-            for (int i = 0; i < (int) (ds.size()); ++i, ++step) {
+            for (; next_batch(); ++step) {
                 optimizer.zero_grad();
-                const auto &example = ds.get(i);
                 const auto &output = model(example.x.to(device));
                 torch::Tensor loss;
                 auto state_value_loss = torch::mse_loss(output.value, example.state_value);
@@ -350,9 +809,9 @@ public:
                     );
                 }
             }
-            train_loss /= (float) ds.size();
+            train_loss /= (float) std::max(1, trained_batches);
             cout << "epoch:" << epoch << " train_loss:" << train_loss << " trained_batches: " << trained_batches
-                 << " total_batches:" << ds.size() << endl;
+                 << endl;
             benchmark_loss = compare_models<TGame, TModel>(model, baseline_model, int(config["eval_size"]),
                                                            config["eval_temperature"], 1.);
             logger.add_scalar("benchmark-loss/eval", step, benchmark_loss);
@@ -364,7 +823,9 @@ public:
             }
         }
         cout << "Saving model " << model_path << ".trained" << endl;
-        torch::save(model, model_path + ".trained");
+        // renamed into place once complete, so a process watching the checkpoint never loads a partial file
+        torch::save(model, model_path + ".trained.tmp");
+        std::filesystem::rename(model_path + ".trained.tmp", model_path + ".trained");
         return benchmark_loss;
     }
 
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "../../third_party/queue/concurrentqueue.h"
+#include "../../third_party/queue/lightweightsemaphore.h"
+
+
+// ConcurrentQueue paired with a semaphore counting enqueued items, so that consumers can sleep while the queue is
+// empty instead of spinning on try_dequeue.
+template<class T>
+class BlockingQueue {
+    moodycamel::ConcurrentQueue<T> queue;
+    moodycamel::LightweightSemaphore items;
+
+public:
+    void enqueue(const T &item) {
+        queue.enqueue(item);
+        items.signal();
+    }
+
+    void enqueue(T &&item) {
+        queue.enqueue(std::move(item));
+        items.signal();
+    }
+
+    bool try_dequeue(T &item) {
+        if (!items.tryWait()) {
+            return false;
+        }
+        while (!queue.try_dequeue(item)) {
+        }
+        return true;
+    }
+
+    // Blocks for at most timeout_us microseconds (forever if negative). Returns false on timeout.
+    bool wait_dequeue(T &item, std::int64_t timeout_us = -1) {
+        if (!items.wait(timeout_us)) {
+            return false;
+        }
+        while (!queue.try_dequeue(item)) {
+        }
+        return true;
+    }
+
+    // Blocks until at least one item is available or timeout_us microseconds elapse, then takes up to max items.
+    // Returns the number of items written to first.
+    template<class It>
+    size_t wait_dequeue_bulk(It first, size_t max, std::int64_t timeout_us = -1) {
+        size_t count = items.waitMany((moodycamel::LightweightSemaphore::ssize_t) max, timeout_us);
+        size_t dequeued = 0;
+        while (dequeued < count) {
+            dequeued += queue.try_dequeue_bulk(first + dequeued, count - dequeued);
+        }
+        return count;
+    }
+
+    size_t size_approx() const {
+        return items.availableApprox();
+    }
+};
+
+
+// BlockingQueue with a fixed number of priority levels, higher levels are dequeued first. All levels share one
+// semaphore, so a bulk dequeue fills a batch from the highest levels down and lower priority items only wait when
+// more higher priority items are pending than fit in one batch.
+template<class T>
+class PriorityBlockingQueue {
+    std::vector<moodycamel::ConcurrentQueue<T>> queues;
+    moodycamel::LightweightSemaphore items;
+
+    // takes exactly count items that are known to be enqueued, scanning from the highest level down
+    template<class It>
+    void take(It first, size_t count) {
+        size_t dequeued = 0;
+        while (dequeued < count) {
+            for (auto level = queues.rbegin(); level != queues.rend() && dequeued < count; ++level) {
+                dequeued += level->try_dequeue_bulk(first + dequeued, count - dequeued);
+            }
+        }
+    }
+
+public:
+    explicit PriorityBlockingQueue(int levels) : queues(std::max(1, levels)) {
+    }
+
+    int levels() const {
+        return (int) queues.size();
+    }
+
+    // priority is clamped to [0, levels())
+    void enqueue(const T &item, int priority = 0) {
+        queues[std::min(std::max(priority, 0), levels() - 1)].enqueue(item);
+        items.signal();
+    }
+
+    bool try_dequeue(T &item) {
+        if (!items.tryWait()) {
+            return false;
+        }
+        take(&item, 1);
+        return true;
+    }
+
+    // Blocks for at most timeout_us microseconds (forever if negative). Returns false on timeout.
+    bool wait_dequeue(T &item, std::int64_t timeout_us = -1) {
+        if (!items.wait(timeout_us)) {
+            return false;
+        }
+        take(&item, 1);
+        return true;
+    }
+
+    // Blocks until at least one item is available or timeout_us microseconds elapse, then takes up to max items,
+    // highest priority first. Returns the number of items written to first.
+    template<class It>
+    size_t wait_dequeue_bulk(It first, size_t max, std::int64_t timeout_us = -1) {
+        size_t count = items.waitMany((moodycamel::LightweightSemaphore::ssize_t) max, timeout_us);
+        take(first, count);
+        return count;
+    }
+
+    size_t size_approx() const {
+        return items.availableApprox();
+    }
+};
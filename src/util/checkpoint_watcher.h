@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <utility>
+
+
+// Polls a checkpoint file written by another process. poll() reports a new checkpoint once the file has changed since
+// the last one seen and its size and modification time stayed the same over two consecutive polls, so that a file
+// still being written is not picked up. The checkpoint keeps being reported until mark_seen() is called, so a caller
+// that fails to load it retries on the next poll. A file present when the watcher is created counts as already seen.
+class CheckpointWatcher {
+    std::string path;
+    std::filesystem::file_time_type seen_time{};
+    std::filesystem::file_time_type last_time{};
+    uintmax_t last_size{0};
+    bool last_exists{false};
+
+    bool stat(std::filesystem::file_time_type &time, uintmax_t &size) const {
+        std::error_code ec;
+        time = std::filesystem::last_write_time(path, ec);
+        if (ec) {
+            return false;
+        }
+        size = std::filesystem::file_size(path, ec);
+        return !ec;
+    }
+
+public:
+    explicit CheckpointWatcher(std::string path) : path(std::move(path)) {
+        uintmax_t size;
+        if (stat(seen_time, size)) {
+            last_time = seen_time;
+            last_size = size;
+            last_exists = true;
+        }
+    }
+
+    const std::string &get_path() const {
+        return path;
+    }
+
+    bool poll() {
+        std::filesystem::file_time_type time;
+        uintmax_t size;
+        if (!stat(time, size)) {
+            last_exists = false;
+            return false;
+        }
+        bool stable = last_exists && time == last_time && size == last_size;
+        last_exists = true;
+        last_time = time;
+        last_size = size;
+        return stable && time != seen_time;
+    }
+
+    // stops reporting the checkpoint returned by the last poll()
+    void mark_seen() {
+        seen_time = last_time;
+    }
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <thread>
+
+#ifdef __linux__
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#endif
+
+
+// Blocks while *word == expected, at most timeout_us microseconds when timeout_us >= 0. process_shared selects the
+// futex flavour for words placed in memory shared between processes.
+inline void futex_wait(std::atomic<int> *word, int expected, bool process_shared, long timeout_us = -1) {
+#ifdef __linux__
+    timespec timeout{timeout_us / 1000000, (timeout_us % 1000000) * 1000};
+    syscall(SYS_futex, reinterpret_cast<int *>(word), process_shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, expected,
+            timeout_us >= 0 ? &timeout : nullptr, nullptr, 0);
+#else
+    std::this_thread::yield();
+#endif
+}
+
+inline void futex_wake(std::atomic<int> *word, bool process_shared) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<int *>(word), process_shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, INT_MAX,
+            nullptr, nullptr, 0);
+#endif
+}
+
+
+// One-shot handoff from a producer to a single waiting thread. wait() spins for a while, since replies usually come
+// within one batch window, then sleeps on a futex. signal() enters the kernel only when the waiter is asleep.
+// A process_shared flag may be placed in shared memory and signalled from another process.
+class CompletionFlag {
+    static const int PENDING = 0;
+    static const int SIGNALLED = 1;
+    static const int SLEEPING = 2;
+
+    std::atomic<int> state{PENDING};
+    bool process_shared;
+
+    void sleep() {
+        futex_wait(&state, SLEEPING, process_shared);
+    }
+
+public:
+    explicit CompletionFlag(bool process_shared = false) : process_shared(process_shared) {
+    }
+
+    // rearms the flag; only the waiting side calls it, before handing the flag to the producer
+    void reset() {
+        state.store(PENDING, std::memory_order_relaxed);
+    }
+
+    // A waiter may return and destroy the flag as soon as the state reads SIGNALLED, so nothing but the futex address
+    // is used after the exchange.
+    void signal() {
+        bool shared = process_shared;
+        if (state.exchange(SIGNALLED, std::memory_order_release) == SLEEPING) {
+            futex_wake(&state, shared);
+        }
+    }
+
+    bool is_set() const {
+        return state.load(std::memory_order_acquire) == SIGNALLED;
+    }
+
+    void wait(int spins = 4096) {
+        for (int i = 0; i < spins; ++i) {
+            if (is_set()) {
+                return;
+            }
+        }
+        while (!is_set()) {
+            int expected = PENDING;
+            if (state.compare_exchange_strong(expected, SLEEPING, std::memory_order_acquire) ||
+                expected == SLEEPING) {
+                sleep();
+            }
+        }
+    }
+
+    // wait() giving up after timeout_us microseconds; returns whether the flag is set
+    bool wait_for(long timeout_us, int spins = 4096) {
+        for (int i = 0; i < spins; ++i) {
+            if (is_set()) {
+                return true;
+            }
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout_us);
+        while (!is_set()) {
+            long left = (long) std::chrono::duration_cast<std::chrono::microseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+            if (left <= 0) {
+                return false;
+            }
+            int expected = PENDING;
+            if (state.compare_exchange_strong(expected, SLEEPING, std::memory_order_acquire) ||
+                expected == SLEEPING) {
+                futex_wait(&state, SLEEPING, process_shared, left);
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+#include <ucontext.h>
+#include "completion_flag.h"
+
+
+// stack of every fiber; the pages are only committed as they are touched
+const size_t FIBER_STACK_SIZE = 512 * 1024;
+
+// how long a thread whose fibers are all blocked sleeps before it checks every flag again
+const long FIBER_IDLE_WAIT_US = 100;
+
+// Cooperative user-space thread with its own stack. resume() runs the body until it calls Fiber::yield() or returns.
+// A fiber is resumed only by the thread that created it.
+class Fiber {
+    ucontext_t context{};
+    ucontext_t caller{};
+    std::unique_ptr<char[]> stack;
+    std::function<void()> body;
+    std::exception_ptr error;
+    bool finished{false};
+
+    static Fiber *&current_fiber() {
+        thread_local Fiber *fiber = nullptr;
+        return fiber;
+    }
+
+    static void entry(unsigned int high, unsigned int low) {
+        auto *fiber = reinterpret_cast<Fiber *>((uintptr_t(high) << 32) | uintptr_t(low));
+        try {
+            fiber->body();
+        } catch (...) {
+            // exceptions can not unwind past the fiber entry point, resume() rethrows them on the caller stack
+            fiber->error = std::current_exception();
+        }
+        fiber->finished = true;
+        swapcontext(&fiber->context, &fiber->caller);
+    }
+
+public:
+    // flag the fiber is blocked on, see await(); null when it is ready to run
+    CompletionFlag *waiting_on{nullptr};
+    // when a fiber blocked in await_for() is resumed even though its flag is not set
+    std::chrono::steady_clock::time_point deadline{std::chrono::steady_clock::time_point::max()};
+
+    explicit Fiber(std::function<void()> body, size_t stack_size = FIBER_STACK_SIZE) :
+            stack(new char[stack_size]), body(std::move(body)) {
+        getcontext(&context);
+        context.uc_stack.ss_sp = stack.get();
+        context.uc_stack.ss_size = stack_size;
+        context.uc_link = nullptr;
+        auto ptr = reinterpret_cast<uintptr_t>(this);
+        makecontext(&context, (void (*)()) &Fiber::entry, 2, (unsigned int) (ptr >> 32), (unsigned int) ptr);
+    }
+
+    Fiber(const Fiber &) = delete;
+
+    Fiber &operator=(const Fiber &) = delete;
+
+    bool done() const {
+        return finished;
+    }
+
+    // runs the fiber until it yields or finishes; returns false once it has finished
+    bool resume() {
+        Fiber *previous = current_fiber();
+        current_fiber() = this;
+        swapcontext(&caller, &context);
+        current_fiber() = previous;
+        if (error) {
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+        return !finished;
+    }
+
+    // fiber running on this thread, null outside of fibers
+    static Fiber *current() {
+        return current_fiber();
+    }
+
+    // suspends the current fiber and returns to the resume() call
+    static void yield() {
+        Fiber *fiber = current_fiber();
+        swapcontext(&fiber->context, &fiber->caller);
+    }
+
+    // Waits for flag to be signalled. Inside a fiber the fiber is suspended until FiberScheduler sees the flag set,
+    // outside of fibers this is a plain blocking wait.
+    static void await(CompletionFlag &flag) {
+        Fiber *fiber = current_fiber();
+        if (!fiber) {
+            flag.wait();
+            return;
+        }
+        while (!flag.is_set()) {
+            fiber->waiting_on = &flag;
+            yield();
+        }
+        fiber->waiting_on = nullptr;
+    }
+
+    // await() giving up after timeout_us microseconds; returns whether flag is set
+    static bool await_for(CompletionFlag &flag, long timeout_us) {
+        Fiber *fiber = current_fiber();
+        if (!fiber) {
+            return flag.wait_for(timeout_us);
+        }
+        fiber->deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeout_us);
+        while (!flag.is_set() && std::chrono::steady_clock::now() < fiber->deadline) {
+            fiber->waiting_on = &flag;
+            yield();
+        }
+        fiber->waiting_on = nullptr;
+        fiber->deadline = std::chrono::steady_clock::time_point::max();
+        return flag.is_set();
+    }
+
+    // whether the scheduler should skip this fiber for now
+    bool blocked() const {
+        return waiting_on && !waiting_on->is_set() &&
+               (deadline == std::chrono::steady_clock::time_point::max() ||
+                std::chrono::steady_clock::now() < deadline);
+    }
+};
+
+
+// Round-robin scheduler for the fibers of one thread. Fibers blocked in Fiber::await() are skipped until their flag is
+// set or their await_for() deadline has passed; when every fiber is blocked the thread sleeps on the flag of the
+// first one for at most FIBER_IDLE_WAIT_US, since the requests of one thread are usually answered by the same batch
+// but any other reply must not wait for it.
+class FiberScheduler {
+    std::vector<std::unique_ptr<Fiber>> fibers;
+
+public:
+    void spawn(std::function<void()> body, size_t stack_size = FIBER_STACK_SIZE) {
+        fibers.emplace_back(new Fiber(std::move(body), stack_size));
+    }
+
+    size_t size() const {
+        return fibers.size();
+    }
+
+    // runs until every spawned fiber has finished
+    void run() {
+        while (!fibers.empty()) {
+            bool progress = false;
+            for (size_t i = 0; i < fibers.size();) {
+                auto &fiber = fibers[i];
+                if (fiber->blocked()) {
+                    ++i;
+                    continue;
+                }
+                progress = true;
+                if (fiber->resume()) {
+                    ++i;
+                } else {
+                    fibers.erase(fibers.begin() + i);
+                }
+            }
+            if (!progress && !fibers.empty()) {
+                fibers.front()->waiting_on->wait_for(FIBER_IDLE_WAIT_US);
+            }
+        }
+    }
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+
+// Lock-free histogram with power of two buckets: bucket 0 counts zeros, bucket i counts values in [2^(i-1), 2^i).
+// Cheap enough to update on every request; percentiles are resolved to the upper bound of a bucket.
+class Log2Histogram {
+public:
+    static const int BUCKETS = 48;
+    typedef std::array<long, BUCKETS> Counts;
+
+private:
+    std::array<std::atomic<long>, BUCKETS> buckets{};
+
+public:
+    static int bucket(uint64_t value) {
+        int b = 0;
+        while (value > 0 && b < BUCKETS - 1) {
+            value >>= 1;
+            b++;
+        }
+        return b;
+    }
+
+    // largest value that falls into bucket b
+    static uint64_t upper_bound(int b) {
+        return b == 0 ? 0 : (uint64_t(1) << b) - 1;
+    }
+
+    void add(uint64_t value) {
+        buckets[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Counts counts() const {
+        Counts result{};
+        for (int b = 0; b < BUCKETS; ++b) {
+            result[b] = buckets[b].load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+
+    static Counts subtract(const Counts &a, const Counts &b) {
+        Counts result{};
+        for (int i = 0; i < BUCKETS; ++i) {
+            result[i] = a[i] - b[i];
+        }
+        return result;
+    }
+
+    static long total(const Counts &counts) {
+        long result = 0;
+        for (auto c : counts) {
+            result += c;
+        }
+        return result;
+    }
+
+    // upper bound of the bucket holding the q-quantile, q in [0, 1]; 0 for an empty histogram
+    static uint64_t percentile(const Counts &counts, double q) {
+        long n = total(counts);
+        if (n == 0) {
+            return 0;
+        }
+        long rank = std::max(1L, (long) (q * (double) n + 0.5));
+        long seen = 0;
+        for (int b = 0; b < BUCKETS; ++b) {
+            seen += counts[b];
+            if (seen >= rank) {
+                return upper_bound(b);
+            }
+        }
+        return upper_bound(BUCKETS - 1);
+    }
+};
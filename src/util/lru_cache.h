@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// Thread-safe bounded LRU cache. Keys are spread over independently locked shards so that concurrent lookups
+// rarely contend; every shard evicts its own least recently used entry once it is full.
+template<class TValue>
+class ShardedLRUCache {
+    struct Shard {
+        std::mutex mutex;
+        std::list<std::pair<uint64_t, TValue>> entries;
+        std::unordered_map<uint64_t, typename std::list<std::pair<uint64_t, TValue>>::iterator> index;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    size_t shard_capacity;
+
+    Shard &shard(uint64_t key) {
+        return *shards[key % shards.size()];
+    }
+
+public:
+    std::atomic<long> hits{0};
+    std::atomic<long> misses{0};
+
+    ShardedLRUCache(size_t capacity, int num_shards) :
+            shard_capacity(std::max<size_t>(1, capacity / std::max(1, num_shards))) {
+        for (int i = 0; i < std::max(1, num_shards); ++i) {
+            shards.emplace_back(new Shard());
+        }
+    }
+
+    bool get(uint64_t key, TValue &value) {
+        auto &s = shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.index.find(key);
+        if (it == s.index.end()) {
+            misses++;
+            return false;
+        }
+        s.entries.splice(s.entries.begin(), s.entries, it->second);
+        value = it->second->second;
+        hits++;
+        return true;
+    }
+
+    void put(uint64_t key, const TValue &value) {
+        auto &s = shard(key);
+        std::lock_guard<std::mutex> lock(s.mutex);
+        auto it = s.index.find(key);
+        if (it != s.index.end()) {
+            it->second->second = value;
+            s.entries.splice(s.entries.begin(), s.entries, it->second);
+            return;
+        }
+        s.entries.emplace_front(key, value);
+        s.index[key] = s.entries.begin();
+        if (s.entries.size() > shard_capacity) {
+            s.index.erase(s.entries.back().first);
+            s.entries.pop_back();
+        }
+    }
+
+    // drops all entries, e.g. after the model producing the cached values has been replaced
+    void clear() {
+        for (auto &s : shards) {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            s->entries.clear();
+            s->index.clear();
+        }
+        hits = 0;
+        misses = 0;
+    }
+
+    size_t size() {
+        size_t result = 0;
+        for (auto &s : shards) {
+            std::lock_guard<std::mutex> lock(s->mutex);
+            result += s->entries.size();
+        }
+        return result;
+    }
+
+    float hit_rate() const {
+        long total = hits + misses;
+        return total > 0 ? (float) hits / (float) total : 0.f;
+    }
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// Read-only view of a whole file through mmap. The mapping is private and writable, so tensors wrapping it may be
+// modified in place without touching the file: pages are copied on write.
+class MappedFile {
+    char *data_{nullptr};
+    size_t size_{0};
+
+public:
+    explicit MappedFile(const std::string &path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("failed to open " + path);
+        }
+        struct stat st{};
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            throw std::runtime_error("failed to stat " + path);
+        }
+        size_ = (size_t) st.st_size;
+        if (size_ > 0) {
+            void *p = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("failed to map " + path);
+            }
+            data_ = (char *) p;
+        }
+        close(fd);
+    }
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    ~MappedFile() {
+        if (data_) {
+            munmap(data_, size_);
+        }
+    }
+
+    char *data() const {
+        return data_;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+};
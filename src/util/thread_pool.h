@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "blocking_queue.h"
+
+
+// Fixed set of worker threads executing submitted tasks. Idle workers sleep on the task queue instead of spinning,
+// and the pool can be kept alive and reused for any number of batches of work.
+class ThreadPool {
+    BlockingQueue<std::function<void()>> tasks;
+    std::vector<std::thread> threads;
+    std::atomic<int> pending{0};
+    std::mutex mutex;
+    std::condition_variable idle;
+
+    void run() {
+        std::function<void()> task;
+        while (true) {
+            tasks.wait_dequeue(task);
+            if (!task) {
+                // shutdown sentinel
+                return;
+            }
+            task();
+            task = nullptr;
+            if (--pending == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                idle.notify_all();
+            }
+        }
+    }
+
+public:
+    explicit ThreadPool(int size) {
+        for (int i = 0; i < std::max(1, size); ++i) {
+            threads.emplace_back(&ThreadPool::run, this);
+        }
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool() {
+        shutdown();
+    }
+
+    int size() const {
+        return (int) threads.size();
+    }
+
+    // number of submitted tasks that have not finished yet
+    int pending_tasks() const {
+        return pending;
+    }
+
+    void submit(std::function<void()> task) {
+        pending++;
+        tasks.enqueue(std::move(task));
+    }
+
+    // blocks until every submitted task has finished
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this]() { return pending == 0; });
+    }
+
+    // lets the submitted tasks finish, then stops and joins the workers
+    void shutdown() {
+        if (threads.empty()) {
+            return;
+        }
+        wait_idle();
+        for (size_t i = 0; i < threads.size(); ++i) {
+            tasks.enqueue(std::function<void()>());
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        threads.clear();
+    }
+};
@@ -19,6 +19,18 @@ std::string to_string(const torch::Tensor &t) {
     return oss.str();
 }
 
+uint64_t hash_tensor(const torch::Tensor &t) {
+    auto contiguous = t.contiguous();
+    auto data = (const uint8_t *) contiguous.data_ptr();
+    size_t size = contiguous.numel() * contiguous.element_size();
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
 void copy_with_alpha(cv::Mat &to, cv::Mat &from, int xPos, int yPos) {
     Mat mask;
     vector<Mat> layers;
@@ -67,3 +79,15 @@ std::unordered_map<std::string, float> load_config_from_file(const std::string&
     buffer << t.rdbuf();
     return load_config_from_string(buffer.str());
 }
+
+torch::Device get_device(const std::unordered_map<std::string, float> &config) {
+    auto it = config.find("device_cuda");
+    int cuda = it == config.end() ? -1 : int(it->second);
+    if (cuda < 0) {
+        cuda = torch::cuda::is_available() ? 1 : 0;
+    }
+    if (cuda > 0 && !torch::cuda::is_available()) {
+        throw std::runtime_error("device_cuda is set but CUDA is not available");
+    }
+    return cuda > 0 ? torch::kCUDA : torch::kCPU;
+}
@@ -31,6 +31,9 @@ const int TILE_SIZE = 128;
 float rand01();
 std::string to_string(const torch::Tensor &t);
 
+// 64-bit FNV-1a hash of the tensor contents, used to identify identical game states
+uint64_t hash_tensor(const torch::Tensor &t);
+
 
 void copy_with_alpha(cv::Mat& to, cv::Mat& from, int xPos, int yPos);
 
@@ -53,5 +56,8 @@ void set_high_thread_priority() ;
 
 std::default_random_engine& get_generator();
 
+// device_cuda config option: 1 - CUDA, 0 - CPU, -1 or missing - CUDA if available
+torch::Device get_device(const std::unordered_map<std::string, float> &config);
+
 std::unordered_map<std::string, float> load_config_from_string(const std::string& fname);
 std::unordered_map<std::string, float> load_config_from_file(const std::string& fname);
\ No newline at end of file
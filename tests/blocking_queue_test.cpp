@@ -0,0 +1,56 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "../src/util/blocking_queue.h"
+
+using namespace std;
+
+
+TEST(BlockingQueueTest, WaitDequeueTimeout) {
+    BlockingQueue<int> queue;
+    int item = 0;
+    ASSERT_FALSE(queue.try_dequeue(item));
+    ASSERT_FALSE(queue.wait_dequeue(item, 1000));
+    queue.enqueue(5);
+    ASSERT_EQ(1, queue.size_approx());
+    ASSERT_TRUE(queue.wait_dequeue(item, 1000));
+    ASSERT_EQ(5, item);
+}
+
+TEST(BlockingQueueTest, WaitDequeueBulk) {
+    BlockingQueue<int> queue;
+    thread producer([&queue]() {
+        for (int i = 0; i < 10; ++i) {
+            queue.enqueue(i);
+        }
+    });
+    vector<int> items(10);
+    size_t size = 0;
+    while (size < items.size()) {
+        size += queue.wait_dequeue_bulk(items.begin() + size, items.size() - size, 100000);
+    }
+    producer.join();
+    ASSERT_EQ(10, size);
+    ASSERT_EQ(0, queue.size_approx());
+}
+
+TEST(BlockingQueueTest, PriorityOrder) {
+    PriorityBlockingQueue<int> queue(3);
+    queue.enqueue(1, 0);
+    queue.enqueue(2, 1);
+    queue.enqueue(3, 2);
+    queue.enqueue(4, 5);  // clamped to the top level
+    queue.enqueue(5, 0);
+    ASSERT_EQ(5, queue.size_approx());
+    vector<int> items(3);
+    ASSERT_EQ(3, queue.wait_dequeue_bulk(items.begin(), 3, 1000));
+    sort(items.begin(), items.end());
+    ASSERT_EQ(vector<int>({2, 3, 4}), items);
+    int item = 0;
+    ASSERT_TRUE(queue.wait_dequeue(item, 1000));
+    ASSERT_TRUE(item == 1 || item == 5);
+    ASSERT_TRUE(queue.try_dequeue(item));
+    ASSERT_FALSE(queue.try_dequeue(item));
+}
@@ -0,0 +1,36 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+#include "../src/util/checkpoint_watcher.h"
+
+using namespace std;
+
+
+TEST(CheckpointWatcherTest, ReportsStableNewCheckpointOnce) {
+    string path = "/tmp/checkpoint_watcher_test_" + to_string(getpid());
+    filesystem::remove(path);
+    {
+        ofstream(path) << "old";
+    }
+    CheckpointWatcher watcher(path);
+    // present at startup
+    ASSERT_FALSE(watcher.poll());
+
+    {
+        ofstream(path) << "new checkpoint";
+    }
+    filesystem::last_write_time(path, filesystem::last_write_time(path) + chrono::seconds(1));
+    // changed, but not yet seen stable
+    ASSERT_FALSE(watcher.poll());
+    ASSERT_TRUE(watcher.poll());
+    // not loaded yet, reported again
+    ASSERT_TRUE(watcher.poll());
+    watcher.mark_seen();
+    ASSERT_FALSE(watcher.poll());
+
+    filesystem::remove(path);
+    ASSERT_FALSE(watcher.poll());
+}
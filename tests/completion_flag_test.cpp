@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+#include <thread>
+
+#include "../src/util/completion_flag.h"
+
+using namespace std;
+
+
+TEST(CompletionFlagTest, SignalBeforeWait) {
+    CompletionFlag flag;
+    ASSERT_FALSE(flag.is_set());
+    flag.signal();
+    ASSERT_TRUE(flag.is_set());
+    flag.wait();
+    flag.reset();
+    ASSERT_FALSE(flag.is_set());
+}
+
+TEST(CompletionFlagTest, WakesSleepingWaiter) {
+    CompletionFlag flag;
+    int value = 0;
+    for (int i = 1; i <= 100; ++i) {
+        flag.reset();
+        thread producer([&flag, &value, i]() {
+            this_thread::sleep_for(chrono::microseconds(i % 10 == 0 ? 2000 : 0));
+            value = i;
+            flag.signal();
+        });
+        flag.wait(i % 2 == 0 ? 0 : 4096);
+        ASSERT_EQ(i, value);
+        producer.join();
+    }
+}
+
+TEST(CompletionFlagTest, WaitForTimesOut) {
+    CompletionFlag flag;
+    ASSERT_FALSE(flag.wait_for(1000));
+    thread producer([&flag]() {
+        this_thread::sleep_for(chrono::milliseconds(2));
+        flag.signal();
+    });
+    ASSERT_TRUE(flag.wait_for(10000000));
+    producer.join();
+}
+
+TEST(CompletionFlagTest, WaiterMayDestroyFlagOnReturn) {
+    for (int i = 0; i < 1000; ++i) {
+        auto *flag = new CompletionFlag(i % 2 == 0);
+        thread producer([flag]() {
+            flag->signal();
+        });
+        if (i % 3 == 0) {
+            flag->wait(0);
+        } else {
+            while (!flag->wait_for(1, 0)) {
+            }
+        }
+        // the producer may still be inside signal()
+        delete flag;
+        producer.join();
+    }
+}
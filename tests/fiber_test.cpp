@@ -0,0 +1,91 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+#include "../src/util/fiber.h"
+
+using namespace std;
+
+
+TEST(FiberTest, YieldInterleavesFibers) {
+    vector<int> trace;
+    FiberScheduler scheduler;
+    for (int f = 0; f < 3; ++f) {
+        scheduler.spawn([&trace, f]() {
+            for (int i = 0; i < 2; ++i) {
+                trace.push_back(f * 10 + i);
+                Fiber::yield();
+            }
+        });
+    }
+    scheduler.run();
+    ASSERT_EQ(vector<int>({0, 10, 20, 1, 11, 21}), trace);
+}
+
+TEST(FiberTest, AwaitSuspendsUntilSignalled) {
+    const int fibers = 64;
+    vector<CompletionFlag> flags(fibers);
+    vector<int> woken(fibers, 0);
+    FiberScheduler scheduler;
+    for (int f = 0; f < fibers; ++f) {
+        scheduler.spawn([&, f]() {
+            Fiber::await(flags[f]);
+            woken[f]++;
+        });
+    }
+    thread producer([&]() {
+        this_thread::sleep_for(chrono::milliseconds(10));
+        // signalled in reverse order, so the scheduler has to skip the fibers still blocked
+        for (int f = fibers - 1; f >= 0; --f) {
+            flags[f].signal();
+        }
+    });
+    scheduler.run();
+    producer.join();
+    ASSERT_EQ(vector<int>(fibers, 1), woken);
+}
+
+TEST(FiberTest, ReplyToLaterFiberIsNotHeldByFirst) {
+    CompletionFlag first, second;
+    bool second_woken = false;
+    FiberScheduler scheduler;
+    scheduler.spawn([&]() {
+        Fiber::await(first);
+    });
+    scheduler.spawn([&]() {
+        Fiber::await(second);
+        second_woken = true;
+        // the first fiber is only released once the second one ran
+        first.signal();
+    });
+    thread producer([&]() {
+        this_thread::sleep_for(chrono::milliseconds(5));
+        second.signal();
+    });
+    scheduler.run();
+    producer.join();
+    ASSERT_TRUE(second_woken);
+}
+
+TEST(FiberTest, AwaitForTimesOutInsideFiber) {
+    CompletionFlag never;
+    CompletionFlag late;
+    bool timed_out = false, woken = false;
+    FiberScheduler scheduler;
+    scheduler.spawn([&]() {
+        timed_out = !Fiber::await_for(never, 2000);
+        late.signal();
+    });
+    scheduler.spawn([&]() {
+        woken = Fiber::await_for(late, 10000000);
+    });
+    scheduler.run();
+    ASSERT_TRUE(timed_out);
+    ASSERT_TRUE(woken);
+}
+
+TEST(FiberTest, ExceptionIsRethrownByResume) {
+    Fiber fiber([]() { throw runtime_error("fiber"); });
+    ASSERT_THROW(fiber.resume(), runtime_error);
+    ASSERT_TRUE(fiber.done());
+}
@@ -0,0 +1,35 @@
+#include <gtest/gtest.h>
+
+#include "../src/util/histogram.h"
+
+using namespace std;
+
+
+TEST(HistogramTest, Buckets) {
+    ASSERT_EQ(0, Log2Histogram::bucket(0));
+    ASSERT_EQ(1, Log2Histogram::bucket(1));
+    ASSERT_EQ(2, Log2Histogram::bucket(3));
+    ASSERT_EQ(3, Log2Histogram::bucket(4));
+    ASSERT_EQ(Log2Histogram::BUCKETS - 1, Log2Histogram::bucket(UINT64_MAX));
+    ASSERT_EQ(7, Log2Histogram::upper_bound(3));
+}
+
+TEST(HistogramTest, Percentiles) {
+    Log2Histogram histogram;
+    ASSERT_EQ(0, Log2Histogram::percentile(histogram.counts(), 0.5));
+    for (int i = 0; i < 90; ++i) {
+        histogram.add(100);
+    }
+    auto before = histogram.counts();
+    for (int i = 0; i < 10; ++i) {
+        histogram.add(5000);
+    }
+    auto counts = histogram.counts();
+    ASSERT_EQ(100, Log2Histogram::total(counts));
+    ASSERT_EQ(127, Log2Histogram::percentile(counts, 0.5));
+    ASSERT_EQ(127, Log2Histogram::percentile(counts, 0.9));
+    ASSERT_EQ(8191, Log2Histogram::percentile(counts, 0.99));
+    auto delta = Log2Histogram::subtract(counts, before);
+    ASSERT_EQ(10, Log2Histogram::total(delta));
+    ASSERT_EQ(8191, Log2Histogram::percentile(delta, 0.5));
+}
@@ -1,6 +1,10 @@
 #include <gtest/gtest.h>
 #include "../src/jackal/jackal.h"
 #include "../src/jackal/game_model.h"
+#include "../src/jackal/quantized_model.h"
+#include "../src/jackal/frozen_model.h"
+#include "../src/jackal/engine_model.h"
+#include "../src/rl/play.h"
 
 
 using namespace std;
@@ -8,7 +12,7 @@ using namespace std;
 TEST(GameModel, TestActionFilters) {
     Jackal game(7, 7, 2);
     JackalModel model(game.get_state().sizes(), 128, 10, 2);
-    auto device = torch::kCUDA;
+    auto device = get_device({});
     model->to(device);
     auto state = game.get_state().to(device);
     vector<torch::Tensor> query = {game.encode_possible_actions()};
@@ -22,4 +26,129 @@ TEST(GameModel, TestActionFilters) {
 
     ASSERT_EQ(2, output.policy.dim());
     ASSERT_EQ(7 * 7 * 7 * 7 * 2, output.policy[0].size(0)); // 2 moves
-}
\ No newline at end of file
+}
+
+TEST(GameModel, TestLegalActionSoftmax) {
+    Jackal game(7, 7, 2);
+    auto actions = game.get_possible_actions();
+    auto logits = torch::randn({7 * 7 * 7 * 7 * 2}) * 3;
+    auto legal = torch::tensor(actions, torch::kLong);
+    auto expected = logits.index({legal}).softmax(0);
+    auto from_logits = filter_renormalize_actions(logits.data_ptr<float>(), actions);
+    auto from_log_proba = filter_renormalize_actions(torch::log_softmax(logits, 0), actions);
+    for (int i = 0; i < actions.size(); ++i) {
+        ASSERT_NEAR(expected[i].item<float>(), from_logits[actions[i]], 1e-6);
+        ASSERT_NEAR(expected[i].item<float>(), from_log_proba[actions[i]], 1e-6);
+    }
+    // a reused result only holds the new actions
+    MCTSActionValue reused{{-1, 1.f}};
+    filter_renormalize_actions(logits.data_ptr<float>(), actions, reused);
+    ASSERT_EQ(from_logits, reused);
+}
+
+TEST(GameModel, TestCloneModel) {
+    Jackal game(7, 7, 2);
+    JackalModel model(game.get_state().sizes(), 16, 2, 2);
+    model->eval();
+    auto replica = clone_model(model);
+    replica->eval();
+    auto state = game.get_state();
+    GameModelOutput expected = model(state);
+    GameModelOutput actual = replica(state);
+    ASSERT_TRUE(torch::allclose(expected.value, actual.value));
+    ASSERT_TRUE(torch::allclose(expected.policy, actual.policy));
+}
+
+TEST(GameModel, TestQuantizedModel) {
+    Jackal game(7, 7, 2);
+    JackalModel model(game.get_state().sizes(), 16, 2, 2);
+    model->eval();
+    vector<torch::Tensor> batches;
+    for (int i = 0; i < 4; ++i) {
+        vector<torch::Tensor> states;
+        for (int t = 0; t < 8 && !game.get_possible_actions().empty(); ++t) {
+            states.push_back(game.get_state());
+            game = game.take_action(game.get_random_action());
+        }
+        batches.push_back(torch::cat(states));
+    }
+    // quantizing works on a copy and leaves the caller's model in training mode
+    model->train();
+    QuantizedJackalModel quantized(model);
+    quantized.calibrate(batches);
+    GameModelOutput output = quantized.forward(batches[0]);
+    ASSERT_EQ(batches[0].size(0), output.value.size(0));
+    ASSERT_EQ(7 * 7 * 7 * 7 * 2, output.policy.size(1));
+    auto report = quantized.evaluate(model, batches);
+    ASSERT_LT(report.value_mse, 0.01);
+    ASSERT_LT(report.policy_kl, 0.1);
+    ASSERT_TRUE(model->is_training());
+}
+
+TEST(GameModel, TestFrozenModel) {
+    Jackal game(7, 7, 2);
+    JackalModel model(game.get_state().sizes(), 16, 2, 2);
+    model->eval();
+    auto state = game.get_state();
+    GameModelOutput expected = model(state);
+    FrozenJackalModel frozen(model);
+    GameModelOutput actual = frozen.forward(state);
+    ASSERT_TRUE(torch::allclose(expected.value, actual.value, 1e-4, 1e-5));
+    ASSERT_TRUE(torch::allclose(expected.policy, actual.policy, 1e-4, 1e-5));
+
+    frozen.save("tmp/frozen_model.bin");
+    FrozenJackalModel loaded("tmp/frozen_model.bin");
+    GameModelOutput reloaded = loaded.forward(state);
+    ASSERT_TRUE(torch::equal(actual.value, reloaded.value));
+    ASSERT_TRUE(torch::equal(actual.policy, reloaded.policy));
+}
+
+TEST(GameModel, TestEngineModel) {
+    for (int size : {7, 12}) {
+        Jackal game(size, size, 2);
+        JackalModel model(game.get_state().sizes(), 64, 2, 2);
+        model->eval();
+        vector<torch::Tensor> states;
+        for (int t = 0; t < 4; ++t) {
+            states.push_back(game.get_state());
+            game = game.take_action(game.get_random_action());
+        }
+        auto batch = torch::cat(states);
+        GameModelOutput expected = model(batch);
+        EngineJackalModel engine(model);
+        GameModelOutput actual = engine.forward(batch);
+        ASSERT_TRUE(torch::allclose(expected.value, actual.value, 1e-4, 1e-4));
+        ASSERT_TRUE(torch::allclose(expected.policy, actual.policy, 1e-4, 1e-4));
+    }
+}
+
+TEST(GameModel, TestFactorizedPolicyHead) {
+    Jackal game(12, 12, 2);
+    JackalModel dense(game.get_state().sizes(), 16, 2, 2, true, POLICY_HEAD_DENSE);
+    JackalModel model(game.get_state().sizes(), 16, 2, 2, true, POLICY_HEAD_FACTORIZED);
+    model->eval();
+    auto parameters = [](JackalModel &m) {
+        int64_t result = 0;
+        for (auto &p : m->parameters()) {
+            result += p.numel();
+        }
+        return result;
+    };
+    ASSERT_LT(parameters(model) * 10, parameters(dense));
+
+    vector<torch::Tensor> states;
+    for (int t = 0; t < 4; ++t) {
+        states.push_back(game.get_state());
+        game = game.take_action(game.get_random_action());
+    }
+    auto batch = torch::cat(states);
+    GameModelOutput expected = model(batch);
+    ASSERT_EQ(12 * 12 * 12 * 12 * 2, expected.policy.size(1));
+
+    FrozenJackalModel frozen(model);
+    GameModelOutput frozen_output = frozen.forward(batch);
+    ASSERT_TRUE(torch::allclose(expected.policy, frozen_output.policy, 1e-4, 1e-5));
+    EngineJackalModel engine(model);
+    GameModelOutput engine_output = engine.forward(batch);
+    ASSERT_TRUE(torch::allclose(expected.policy, engine_output.policy, 1e-4, 1e-4));
+}
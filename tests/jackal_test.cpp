@@ -52,6 +52,18 @@ TEST(JackalTest, StateUpdates) {
     ASSERT_FALSE(torch::all(torch::eq(j1.get_state(), jackal.get_state())).item().toBool());
 }
 
+TEST(JackalTest, LoadAddsPlayers) {
+    Jackal four(7, 7, 4);
+    Jackal two(7, 7, 2);
+    torch::Tensor state = four.get_state()[0].clone();
+    two.load(state);
+    ASSERT_EQ(4, two.players.size());
+    ASSERT_TRUE(four.get_state().equal(two.get_state()));
+    ASSERT_EQ(four.get_possible_actions(), two.get_possible_actions());
+    two = two.take_action(two.get_random_action());
+    ASSERT_FALSE(two.get_possible_actions().empty());
+}
+
 
 TEST(JackalTest, FullTrainingCycle) {
     TestGuard g;
@@ -96,7 +108,7 @@ TEST(JackalTest, FullTrainingCycle) {
                     results.push_back(
                             mcts_model_self_play(
                                     game, model, model, int(config["mcts_iterations"]),
-                                    int(config["simulation_max_turns"]), 1, 1, nullptr, torch::kCUDA
+                                    int(config["simulation_max_turns"]), 1, 1, nullptr, get_device(config)
                             )
                     );
                 }
@@ -112,3 +124,14 @@ TEST(JackalTest, TestEncodeDecodeAction) {
         ASSERT_EQ(a, j.encode_action(j.decode_action(a)));
     }
 }
+
+TEST(JackalTest, TestEncodeDecodeActionSpace) {
+    Jackal j(7, 7, 2);
+    for (int code = 0; code < 7 * 7 * 7 * 7 * 2; ++code) {
+        ASSERT_EQ(code, j.encode_action(j.decode_action(code)));
+    }
+    // moves in the same direction share the offset part of the code
+    Action a(Coords(1, 1), Coords(2, 1), false);
+    Action b(Coords(4, 5), Coords(5, 5), false);
+    ASSERT_EQ(j.encode_action(a) % (7 * 7 * 2), j.encode_action(b) % (7 * 7 * 2));
+}
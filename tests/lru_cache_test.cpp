@@ -0,0 +1,44 @@
+#include <gtest/gtest.h>
+#include <string>
+
+#include "../src/util/lru_cache.h"
+
+using namespace std;
+
+
+TEST(LRUCacheTest, GetPut) {
+    ShardedLRUCache<string> cache(4, 1);
+    string value;
+    ASSERT_FALSE(cache.get(1, value));
+    cache.put(1, "a");
+    ASSERT_TRUE(cache.get(1, value));
+    ASSERT_EQ("a", value);
+    ASSERT_EQ(1, cache.hits);
+    ASSERT_EQ(1, cache.misses);
+    ASSERT_FLOAT_EQ(0.5, cache.hit_rate());
+}
+
+TEST(LRUCacheTest, EvictsLeastRecentlyUsed) {
+    ShardedLRUCache<int> cache(2, 1);
+    int value;
+    cache.put(1, 1);
+    cache.put(2, 2);
+    ASSERT_TRUE(cache.get(1, value));
+    cache.put(3, 3);
+    ASSERT_EQ(2, cache.size());
+    ASSERT_TRUE(cache.get(1, value));
+    ASSERT_FALSE(cache.get(2, value));
+    ASSERT_TRUE(cache.get(3, value));
+}
+
+TEST(LRUCacheTest, Clear) {
+    ShardedLRUCache<int> cache(16, 4);
+    int value;
+    for (int i = 0; i < 8; ++i) {
+        cache.put(i, i);
+    }
+    ASSERT_EQ(8, cache.size());
+    cache.clear();
+    ASSERT_EQ(0, cache.size());
+    ASSERT_FALSE(cache.get(0, value));
+}
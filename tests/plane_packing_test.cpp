@@ -0,0 +1,41 @@
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+#include "../src/rl/plane_packing.h"
+
+using namespace std;
+
+
+TEST(PlanePackingTest, PacksAndUnpacksMixedPlanes) {
+    // a 7x7 board leaves a tail after the 8-value blocks of every plane
+    const int64_t rows = 3, planes = 4, plane_size = 49;
+    vector<float> x(rows * planes * plane_size);
+    default_random_engine rng(123);
+    for (int64_t r = 0; r < rows; ++r) {
+        for (int64_t i = 0; i < plane_size; ++i) {
+            float *row = &x[r * planes * plane_size];
+            row[i] = (float) (rng() % 2);
+            row[plane_size + i] = (float) (rng() % 16);
+            row[2 * plane_size + i] = (float) ((int) (rng() % 256) - 128);
+            row[3 * plane_size + i] = 0.f;
+        }
+    }
+    auto bits = PlanePacking::fit(x.data(), rows, planes, plane_size);
+    ASSERT_EQ(vector<int8_t>({PLANE_BITS_BINARY, PLANE_BITS_NIBBLE, PLANE_BITS_BYTE, PLANE_BITS_BINARY}), bits);
+    PlanePacking packing(bits, plane_size);
+    ASSERT_EQ(7 + 25 + 49 + 7, packing.row_bytes());
+
+    vector<uint8_t> packed(rows * packing.row_bytes());
+    packing.pack(x.data(), rows, packed.data());
+    vector<float> unpacked(x.size(), -1.f);
+    packing.unpack(packed.data(), rows, unpacked.data());
+    ASSERT_EQ(x, unpacked);
+}
+
+TEST(PlanePackingTest, FitRejectsNonIntegerValues) {
+    vector<float> x = {0.f, 1.f, 0.5f, 2.f};
+    ASSERT_TRUE(PlanePacking::fit(x.data(), 1, 2, 2).empty());
+    x[2] = 200.f;
+    ASSERT_TRUE(PlanePacking::fit(x.data(), 1, 2, 2).empty());
+}
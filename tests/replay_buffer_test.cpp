@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+#include <set>
+
+#include "../src/rl/replay_buffer.h"
+#include "helpers.h"
+
+using namespace std;
+
+
+// rows positions whose planes and targets all hold first, first + 1, ...
+static vector<torch::Tensor> positions(int rows, int first) {
+    auto ids = torch::arange(first, first + rows, torch::kFloat32);
+    return {ids.view({rows, 1, 1, 1}).expand({rows, 2, 3, 3}).contiguous(), ids.to(torch::kLong),
+            torch::stack({ids, -ids}, 1), ids.to(torch::kInt32)};
+}
+
+TEST(ReplayBufferTest, KeepsTheNewestPositions) {
+    TestGuard g;
+    ReplayBuffer replay(10);
+    for (int first = 0; first < 16; first += 4) {
+        auto p = positions(4, first);
+        replay.add(p[0], p[1], p[2], p[3]);
+    }
+    ASSERT_EQ(10, replay.size());
+    auto batch = replay.sample(200, get_generator());
+    set<int> seen;
+    for (int i = 0; i < 200; ++i) {
+        int id = batch.model_version[i].item<int>();
+        seen.insert(id);
+        ASSERT_TRUE(batch.x[i].eq((float) id).all().item<bool>());
+        ASSERT_EQ(id, batch.action[i].item<int64_t>());
+        ASSERT_EQ((float) -id, batch.state_value[i][1].item<float>());
+    }
+    // positions 0-5 were evicted
+    ASSERT_EQ(6, *seen.begin());
+    ASSERT_EQ(15, *seen.rbegin());
+    ASSERT_EQ(10, seen.size());
+    // ids up to 15 need nibbles, a non-integer state switches to floats
+    ASSERT_TRUE(replay.is_packed());
+    auto p = positions(1, 0);
+    replay.add(p[0] + 0.5f, p[1], p[2], p[3]);
+    ASSERT_FALSE(replay.is_packed());
+    ASSERT_EQ(10, replay.size());
+    batch = replay.sample(200, get_generator());
+    for (int i = 0; i < 200; ++i) {
+        int id = batch.model_version[i].item<int>();
+        ASSERT_NE(6, id);
+        ASSERT_TRUE(batch.x[i].eq(id == 0 ? 0.5f : (float) id).all().item<bool>());
+    }
+}
+
+TEST(ReplayBufferTest, WeightedSampling) {
+    TestGuard g;
+    ReplayBuffer replay(100);
+    auto p = positions(8, 0);
+    replay.add(p[0], p[1], p[2], p[3]);
+    ASSERT_EQ(7, replay.newest_model_version());
+    // only versions 6 and 7, the second 3 times as often
+    replay.set_weights([](int32_t version) {
+        return version == 7 ? 3.f : (version == 6 ? 1.f : 0.f);
+    });
+    auto batch = replay.sample(4000, get_generator());
+    int sevens = batch.model_version.eq(7).sum().item<int>();
+    int sixes = batch.model_version.eq(6).sum().item<int>();
+    ASSERT_EQ(4000, sevens + sixes);
+    ASSERT_NEAR(3000, sevens, 150);
+}
@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+#include "../src/jackal/jackal.h"
+#include "../src/rl/self_play_checkpoint.h"
+#include "helpers.h"
+
+using namespace std;
+
+
+TEST(SelfPlayCheckpointTest, SaveLoadRoundTrip) {
+    TestGuard g;
+    Jackal jackal(7, 7, 2);
+    SelfPlayCheckpoint checkpoint;
+    checkpoint.games_completed = 5;
+    GameInProgress game;
+    for (int i = 0; i < 3 && !jackal.is_terminal(); ++i) {
+        MCTSStateActionValue sav{{0.5f, -0.5f}, {}};
+        for (int a : jackal.get_possible_actions()) {
+            sav.action_proba[a] = 1.f / (float) (a + 1);
+        }
+        game.history.add_state(jackal.get_state(), sav);
+        jackal = jackal.take_action(jackal.get_random_action());
+    }
+    game.state = jackal.get_state();
+    game.turn = jackal.turn;
+    game.history.model_version = 2;
+    checkpoint.games.push_back(game);
+
+    std::filesystem::create_directories("tmp");
+    checkpoint.save("tmp/self_play_checkpoint.bin");
+    SelfPlayCheckpoint loaded;
+    ASSERT_TRUE(loaded.load("tmp/self_play_checkpoint.bin"));
+    ASSERT_FALSE(loaded.load("tmp/self_play_checkpoint_missing.bin"));
+    ASSERT_EQ(5, loaded.games_completed);
+    ASSERT_EQ(1, loaded.games.size());
+    auto &restored = loaded.games[0];
+    ASSERT_EQ(game.turn, restored.turn);
+    ASSERT_EQ(2, restored.history.model_version);
+    ASSERT_TRUE(game.state.equal(restored.state));
+    ASSERT_EQ(game.history.states.size(), restored.history.states.size());
+    for (size_t i = 0; i < game.history.states.size(); ++i) {
+        ASSERT_TRUE(game.history.states[i].equal(restored.history.states[i]));
+        ASSERT_EQ(game.history.state_action_values[i].state_value,
+                  restored.history.state_action_values[i].state_value);
+        ASSERT_EQ(game.history.state_action_values[i].action_proba,
+                  restored.history.state_action_values[i].action_proba);
+    }
+
+    // the saved position continues on a fresh board
+    Jackal resumed(7, 7, 2);
+    torch::Tensor state = restored.state[0].clone();
+    resumed.load(state);
+    resumed.turn = restored.turn;
+    ASSERT_TRUE(jackal.get_state().equal(resumed.get_state()));
+    ASSERT_EQ(jackal.get_current_player_id(), resumed.get_current_player_id());
+    ASSERT_EQ(jackal.get_possible_actions(), resumed.get_possible_actions());
+}
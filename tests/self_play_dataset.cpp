@@ -5,6 +5,8 @@
 #include "../src/tictactoe/tictactoe.h"
 #include "helpers.h"
 #include <filesystem>
+#include <fstream>
+#include <numeric>
 
 using namespace std;
 
@@ -25,6 +27,189 @@ TEST(SPDS, TestSelfPlayDataSet) {
               to_string(ex.action_proba));
 }
 
+TEST(SPDS, ModelVersionRoundTrip) {
+    TestGuard g;
+    TicTacToeModel model;
+    TicTacToe game;
+    auto self_play = mcts_model_self_play<TicTacToe, TicTacToeModel>(game, model, model, 1, 10, 1., 1.);
+    self_play.model_version = 3;
+    auto ds = SelfPlayDataset(std::vector<SelfPlayResult>{self_play}, 4, false);
+    ds.save("tmp/testds_version.bin");
+    ds.load("tmp/testds_version.bin");
+    ASSERT_FALSE(ds.examples.empty());
+    for (auto &ex : ds.examples) {
+        ASSERT_EQ(ex.x.size(0), ex.model_version.size(0));
+        ASSERT_TRUE(ex.model_version.eq(3).all().item<bool>());
+    }
+}
+
+TEST(SPDS, ColumnarFileRoundTrip) {
+    TestGuard g;
+    SelfPlayDataset ds;
+    for (int rows : {3, 2}) {
+        ds.examples.push_back(SelfPlayDataset::Example{
+                torch::rand({rows, 2, 3, 3}),
+                torch::randint(9, {rows}, torch::kLong),
+                torch::rand({rows, 2}),
+                torch::full({rows}, rows, torch::kInt32)
+        });
+    }
+    ds.save("tmp/testds_columnar.bin");
+    SelfPlayDataset loaded;
+    loaded.load("tmp/testds_columnar.bin");
+    ASSERT_EQ(2, loaded.examples.size());
+    for (int i = 0; i < 2; ++i) {
+        auto &ex = ds.examples[i], &l = loaded.examples[i];
+        ASSERT_TRUE(ex.x.equal(l.x));
+        ASSERT_TRUE(ex.action_proba.equal(l.action_proba));
+        ASSERT_TRUE(ex.state_value.equal(l.state_value));
+        ASSERT_TRUE(ex.model_version.equal(l.model_version));
+    }
+
+    // a version 2 file of torch::save'd tensors has action codes of the old encoding
+    {
+        std::ofstream f("tmp/testds_v2.bin", std::ios::out | std::ios::binary);
+        int32_t header[2] = {-2, 1};
+        f.write((char *) header, sizeof(header));
+        auto &ex = ds.examples[0];
+        for (auto &t : {ex.x, ex.action_proba, ex.state_value, ex.model_version}) {
+            SelfPlayDataset::save_tensor(t, f);
+        }
+    }
+    ASSERT_THROW(loaded.load("tmp/testds_v2.bin"), std::runtime_error);
+}
+
+TEST(SPDS, PackedPlanesRoundTrip) {
+    TestGuard g;
+    SelfPlayDataset ds;
+    int rows = 16;
+    ds.examples.push_back(SelfPlayDataset::Example{
+            torch::cat({torch::randint(2, {rows, 2, 7, 7}, torch::kFloat32),
+                        torch::randint(16, {rows, 1, 7, 7}, torch::kFloat32)}, 1),
+            torch::randint(9, {rows}, torch::kLong),
+            torch::rand({rows, 2}),
+            torch::full({rows}, 1, torch::kInt32)
+    });
+    ds.save("tmp/testds_packed.bin");
+    // 2 bitmask planes and a nibble plane take 7 + 7 + 25 bytes per row instead of 3 * 49 floats
+    ASSERT_LT(std::filesystem::file_size("tmp/testds_packed.bin"), rows * 3 * 49 * 4 / 4);
+    SelfPlayDataset loaded;
+    loaded.load("tmp/testds_packed.bin");
+    ASSERT_EQ(1, loaded.examples.size());
+    ASSERT_TRUE(ds.examples[0].x.equal(loaded.examples[0].x));
+    ASSERT_TRUE(ds.examples[0].state_value.equal(loaded.examples[0].state_value));
+}
+
+TEST(SPDS, SaveToDirNamesFilesUniquely) {
+    TestGuard g;
+    std::string dir = "tmp/testds_names";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    SelfPlayDataset ds;
+    ds.examples.push_back(SelfPlayDataset::Example{torch::zeros({1, 1, 3, 3}), torch::zeros({1}, torch::kLong),
+                                                   torch::zeros({1, 2}), torch::zeros({1}, torch::kInt32)});
+    ds.save_to_dir(dir);
+    ds.save_to_dir(dir);
+    auto files = get_selfplay_files(dir);
+    ASSERT_EQ(2, files.size());
+    ASSERT_NE(files[0], files[1]);
+    // no temporary files are left behind, and timestamped files sort after the old selfplay_N.bin names
+    ASSERT_EQ(2, std::distance(std::filesystem::directory_iterator(dir), std::filesystem::directory_iterator()));
+    for (auto &f : files) {
+        ASSERT_GT(selfplay_file_number(f), selfplay_file_number(dir + "/selfplay_1000.bin"));
+    }
+}
+
+TEST(SPDS, LoaderStreamsEveryBatchOnce) {
+    TestGuard g;
+    std::string dir = "tmp/testds_loader";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    for (int file = 0; file < 3; ++file) {
+        SelfPlayDataset ds;
+        for (int batch = 0; batch < 4; ++batch) {
+            int id = file * 4 + batch;
+            ds.examples.push_back(SelfPlayDataset::Example{
+                    torch::full({2, 1, 3, 3}, (float) id),
+                    torch::zeros({2}, torch::kLong),
+                    torch::zeros({2, 2}),
+                    torch::full({2}, id, torch::kInt32)
+            });
+        }
+        ds.save_to_dir(dir);
+    }
+    // a single prefetch slot makes the readers wait for the training loop
+    SelfPlayLoader loader(get_selfplay_files(dir), 1.f, 2, 1);
+    std::vector<int> seen;
+    SelfPlayDataset::Example ex;
+    while (loader.next(ex)) {
+        seen.push_back(ex.model_version[0].item<int>());
+        ASSERT_TRUE(ex.x.eq(seen.back()).all().item<bool>());
+    }
+    std::sort(seen.begin(), seen.end());
+    std::vector<int> expected(12);
+    std::iota(expected.begin(), expected.end(), 0);
+    ASSERT_EQ(expected, seen);
+}
+
+TEST(SPDS, ReplayReadsOnlyTheNewestFiles) {
+    TestGuard g;
+    string dir = "tmp/testreplay";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    for (int version = 1; version <= 5; ++version) {
+        SelfPlayDataset ds;
+        ds.examples.push_back(SelfPlayDataset::Example{
+                torch::randint(2, {4, 2, 3, 3}, torch::kFloat32),
+                torch::randint(9, {4}, torch::kLong),
+                torch::rand({4, 2}),
+                torch::full({4}, version, torch::kInt32)
+        });
+        ds.save(dir + "/selfplay_" + to_string(version) + ".bin");
+    }
+    // the oldest file falls out of the window, so it must not even be opened
+    std::ofstream(dir + "/selfplay_1.bin", std::ios::trunc) << "corrupt";
+    unordered_map<string, float> config{{"train_loader_threads", 2}};
+    Trainer<TicTacToe, TicTacToeModel> trainer(config);
+    trainer.replay.reset(new ReplayBuffer(6));
+    trainer.update_replay(dir);
+    ASSERT_EQ(6, trainer.replay->size());
+    ASSERT_EQ(5, trainer.replayed_files.size());
+    auto batch = trainer.replay->sample(100, get_generator());
+    ASSERT_TRUE(batch.model_version.ge(4).all().item<bool>());
+}
+
+TEST(SPDS, OldVersionFilesAreSkipped) {
+    TestGuard g;
+    string dir = "tmp/testoldversions";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    for (int version = 1; version <= 2; ++version) {
+        SelfPlayDataset ds;
+        ds.examples.push_back(SelfPlayDataset::Example{
+                torch::randint(2, {4, 2, 3, 3}, torch::kFloat32),
+                torch::randint(9, {4}, torch::kLong),
+                torch::rand({4, 2}),
+                torch::full({4}, version, torch::kInt32)
+        });
+        ds.save(dir + "/selfplay_" + to_string(version) + ".bin");
+    }
+    {
+        // header of a version 3 file, whose action codes use the old encoding
+        std::ofstream f(dir + "/selfplay_3.bin", std::ios::out | std::ios::binary);
+        SelfPlayFileHeader header{};
+        header.version = -3;
+        f.write((char *) &header, sizeof(header));
+    }
+    ASSERT_EQ(2, get_loadable_selfplay_files(dir).size());
+    unordered_map<string, float> config{{"train_loader_threads", 2}};
+    Trainer<TicTacToe, TicTacToeModel> trainer(config);
+    trainer.replay.reset(new ReplayBuffer(100));
+    trainer.update_replay(dir);
+    ASSERT_EQ(8, trainer.replay->size());
+    ASSERT_EQ(3, trainer.replayed_files.size());
+}
+
 TEST(SPDS, AnalyzeSPDS) {
     SelfPlayDataset ds;
     auto fnames = get_selfplay_files("tmp/jackal/epoch0/");
@@ -50,4 +235,45 @@ TEST(SPDS, AnalyzeSPDS) {
     cout << total << endl;
     total = 0;
     state_values = torch::zeros({2});
-}
\ No newline at end of file
+}
+
+TEST(SPDS, ResignationAndDrawAdjudication) {
+    TestGuard g;
+    // player 0 is always lost, player 1 always won
+    MCTSStateValue values{-0.95f, 0.95f};
+    auto value_func = [&values](const TicTacToe &state) {
+        MCTSStateActionValue result;
+        auto actions = state.get_possible_actions();
+        for (int a : actions) {
+            result.action_proba[a] = 1.f / (float) actions.size();
+        }
+        result.state_value = values;
+        return result;
+    };
+    SelfPlayAdjudication adjudication;
+    adjudication.resign_threshold = -0.9f;
+    adjudication.resign_moves = 2;
+    auto resigned = mcts_model_self_play<TicTacToe>(TicTacToe(), value_func, 1, 10, 1.f, 1.f, UCT_PUCT, nullptr,
+            nullptr, false, SelfPlayResult(), nullptr, adjudication);
+    ASSERT_EQ(0, resigned.resigned_player);
+    ASSERT_EQ(MCTSStateValue({-1.f, 1.f}), resigned.self_play_reward);
+    // player 0 resigns at its second move, after 2 moves played
+    ASSERT_EQ(3, resigned.states.size());
+
+    adjudication.no_resign = true;
+    auto calibration = mcts_model_self_play<TicTacToe>(TicTacToe(), value_func, 1, 10, 1.f, 1.f, UCT_PUCT, nullptr,
+            nullptr, false, SelfPlayResult(), nullptr, adjudication);
+    ASSERT_EQ(-1, calibration.resigned_player);
+    ASSERT_EQ(0, calibration.would_resign_player);
+    ASSERT_GT(calibration.states.size(), 3);
+
+    values = {0.01f, -0.01f};
+    adjudication = SelfPlayAdjudication();
+    adjudication.draw_threshold = 0.05f;
+    adjudication.draw_moves = 3;
+    auto draw = mcts_model_self_play<TicTacToe>(TicTacToe(), value_func, 1, 10, 1.f, 1.f, UCT_PUCT, nullptr,
+            nullptr, false, SelfPlayResult(), nullptr, adjudication);
+    ASSERT_TRUE(draw.adjudicated_draw);
+    ASSERT_EQ(MCTSStateValue({0.f, 0.f}), draw.self_play_reward);
+    ASSERT_EQ(3, draw.states.size());
+}
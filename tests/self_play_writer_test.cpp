@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include <filesystem>
+
+#include "../src/rl/self_play_writer.h"
+#include "../src/tictactoe/tictactoe.h"
+#include "../src/tictactoe/tictactoe_model.h"
+#include "helpers.h"
+
+using namespace std;
+
+
+TEST(SelfPlayWriterTest, FlushWritesQueuedGames) {
+    TestGuard g;
+    TicTacToeModel model;
+    auto game = mcts_model_self_play<TicTacToe, TicTacToeModel>(TicTacToe(), model, model, 1, 10, 1., 1.);
+    string dir = "tmp/self_play_writer_test";
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir);
+    {
+        // a queue of one game makes every add wait for the writer
+        SelfPlayWriter writer(dir, 2, 4, 1.f, 1);
+        for (int i = 0; i < 3; ++i) {
+            SelfPlayResult copy(game);
+            writer.add(std::move(copy));
+        }
+        writer.flush();
+        ASSERT_EQ(3, writer.games_written());
+        ASSERT_EQ(0, writer.games_queued());
+        // a full file of 2 games and the flushed one
+        ASSERT_EQ(2, get_selfplay_files(dir).size());
+
+        SelfPlayResult copy(game);
+        writer.add(std::move(copy));
+        writer.close();
+        ASSERT_EQ(4, writer.games_written());
+    }
+    auto files = get_selfplay_files(dir);
+    ASSERT_EQ(3, files.size());
+    SelfPlayDataset ds;
+    ds.load(files);
+    ASSERT_FALSE(ds.examples.empty());
+}
@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+
+#include "../src/rl/shared_inference.h"
+
+using namespace std;
+
+
+// pid of a process that no longer exists
+static int dead_pid() {
+    pid_t child = fork();
+    if (child == 0) {
+        _exit(0);
+    }
+    waitpid(child, nullptr, 0);
+    return child;
+}
+
+TEST(SharedInferenceTest, RequestsRoundTripThroughSharedMemory) {
+    string name = "/jackal_inference_test_" + to_string(getpid());
+    auto region = SharedInferenceRegion::create(name, 8, {1, 3}, 2, 4);
+    TModelQueue queue(INFERENCE_PRIORITY_LEVELS);
+    SharedInferenceBridge bridge(*region, queue);
+    atomic<bool> terminated(false);
+    thread bridge_thread(&SharedInferenceBridge::run, &bridge, &terminated);
+    // stands in for the InferenceServer: value is the sum of the state, policy repeats the priority
+    thread server([&]() {
+        TModelJob job;
+        while (!terminated) {
+            if (!queue.wait_dequeue(job, 1000)) {
+                continue;
+            }
+            auto &r = *job.reply;
+            float sum = job.state->sum().item<float>();
+            r.value = {sum, -sum};
+            r.policy.assign(4, (float) job.state->size(1));
+            r.has_policy = true;
+            r.complete();
+        }
+    });
+
+    SharedInferenceClient client(name);
+    vector<thread> threads;
+    atomic<int> failures(0);
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            InferenceReply reply;
+            for (int i = 0; i < 100; ++i) {
+                auto x = torch::full({1, 3}, (float) (t * 1000 + i));
+                client.request(x, reply, INFERENCE_PRIORITY_SELF_PLAY);
+                if (reply.value != vector<float>({x.sum().item<float>(), -x.sum().item<float>()}) ||
+                    reply.policy != vector<float>(4, 3.f) || !reply.has_policy) {
+                    failures++;
+                }
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    terminated = true;
+    bridge_thread.join();
+    server.join();
+    ASSERT_EQ(0, failures);
+}
+
+TEST(SharedInferenceTest, RepliesAreWrittenInCompletionOrder) {
+    string name = "/jackal_inference_order_" + to_string(getpid());
+    auto region = SharedInferenceRegion::create(name, 4, {1, 3}, 2, 0);
+    TModelQueue queue(INFERENCE_PRIORITY_LEVELS);
+    SharedInferenceBridge bridge(*region, queue);
+    atomic<bool> terminated(false);
+    thread bridge_thread(&SharedInferenceBridge::run, &bridge, &terminated);
+    atomic<bool> first_taken(false), second_answered(false), first_answered(false);
+    // answers the second request first and holds the first one until the second client got its reply
+    thread server([&]() {
+        TModelJob first, second;
+        while (!queue.wait_dequeue(first, 1000)) {
+        }
+        first_taken = true;
+        while (!queue.wait_dequeue(second, 1000)) {
+        }
+        second.reply->value = {1.f, -1.f};
+        second.reply->complete();
+        auto deadline = chrono::steady_clock::now() + chrono::seconds(2);
+        while (!second_answered && chrono::steady_clock::now() < deadline) {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        first_answered = true;
+        first.reply->value = {0.f, 0.f};
+        first.reply->complete();
+    });
+
+    SharedInferenceClient client(name);
+    thread low([&]() {
+        InferenceReply reply;
+        auto x = torch::zeros({1, 3});
+        client.request(x, reply, INFERENCE_PRIORITY_SELF_PLAY);
+    });
+    while (!first_taken) {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+    InferenceReply reply;
+    auto x = torch::ones({1, 3});
+    client.request(x, reply, INFERENCE_PRIORITY_LONG_GAME);
+    // the reply did not wait for the older request still held by the server
+    bool overtook = !first_answered;
+    second_answered = true;
+    low.join();
+    server.join();
+    terminated = true;
+    bridge_thread.join();
+    ASSERT_TRUE(overtook);
+    ASSERT_EQ(vector<float>({1.f, -1.f}), reply.value);
+}
+
+TEST(SharedInferenceTest, OpenWithoutServerThrows) {
+    ASSERT_THROW(SharedInferenceClient("/jackal_inference_missing_" + to_string(getpid())), std::runtime_error);
+}
+
+TEST(SharedInferenceTest, RequestThrowsWhenServerIsGone) {
+    string name = "/jackal_inference_gone_" + to_string(getpid());
+    auto region = SharedInferenceRegion::create(name, 2, {1, 3}, 2, 0);
+    region->header().server_pid = dead_pid();
+    SharedInferenceClient client(name);
+    InferenceReply reply;
+    auto x = torch::zeros({1, 3});
+    ASSERT_THROW(client.request(x, reply, INFERENCE_PRIORITY_SELF_PLAY), std::runtime_error);
+}
+
+TEST(SharedInferenceTest, SlotsOfDeadClientsAreReclaimed) {
+    string name = "/jackal_inference_reclaim_" + to_string(getpid());
+    auto region = SharedInferenceRegion::create(name, 2, {1, 3}, 2, 0);
+    auto &slot = region->slot(0);
+    slot.owner_pid = dead_pid();
+    slot.state = SHARED_SLOT_CLAIMED;
+    TModelQueue queue(INFERENCE_PRIORITY_LEVELS);
+    SharedInferenceBridge bridge(*region, queue);
+    atomic<bool> terminated(false);
+    thread bridge_thread(&SharedInferenceBridge::run, &bridge, &terminated);
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(10 * SHARED_INFERENCE_SWEEP_MS);
+    while (slot.state != SHARED_SLOT_FREE && chrono::steady_clock::now() < deadline) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    terminated = true;
+    bridge_thread.join();
+    ASSERT_EQ(SHARED_SLOT_FREE, slot.state.load());
+    ASSERT_EQ(0, slot.owner_pid.load());
+}
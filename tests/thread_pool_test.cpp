@@ -0,0 +1,35 @@
+#include <gtest/gtest.h>
+#include <atomic>
+
+#include "../src/util/thread_pool.h"
+
+using namespace std;
+
+
+TEST(ThreadPoolTest, RunsTasksAcrossBatches) {
+    ThreadPool pool(4);
+    ASSERT_EQ(4, pool.size());
+    atomic<int> done(0);
+    for (int batch = 1; batch <= 3; ++batch) {
+        for (int i = 0; i < 100; ++i) {
+            pool.submit([&done]() { done++; });
+        }
+        pool.wait_idle();
+        ASSERT_EQ(100 * batch, done);
+        ASSERT_EQ(0, pool.pending_tasks());
+    }
+}
+
+TEST(ThreadPoolTest, ShutdownFinishesSubmittedTasks) {
+    atomic<int> done(0);
+    {
+        ThreadPool pool(2);
+        for (int i = 0; i < 10; ++i) {
+            pool.submit([&done]() {
+                this_thread::sleep_for(chrono::milliseconds(1));
+                done++;
+            });
+        }
+    }
+    ASSERT_EQ(10, done);
+}